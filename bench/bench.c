@@ -0,0 +1,1026 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Benchmark suite of the 'strings' library: every benchmark runs on every
+    synthetic corpus at every size from 16 bytes up to the maximum size,
+    the results are printed to stdout as a JSON array
+
+    Usage: bench [--max-size BYTES] [--min-time SECONDS] [--filter NAME]
+*/
+
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
+#include "strings.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+typedef enum
+{
+    corpus_ascii,
+    corpus_latin,
+    corpus_cjk,
+    corpus_emoji,
+    corpus_separators,
+    corpus_repetitive,
+    corpus_count
+} corpus_type_t;
+
+static const char *corpus_names[corpus_count] =
+{
+    "ascii", "latin", "cjk", "emoji", "separators", "repetitive"
+};
+
+typedef struct
+{
+    string_t text;
+    wide_string_t wide_text;
+    string_t copy;
+    string_t needle;
+    string_t lines;
+    string_t integers;
+    string_t decimals;
+    string_t scratch;
+    wide_string_t wide_scratch;
+    wide_string_t wide_copy;
+    strings_list_t *fields;
+    wide_strings_list_t *wide_fields;
+    string_views_list_t *views;
+    string_format_t *format;
+    char separator;
+    char *file_name;
+} corpus_t;
+
+typedef void (*benchmark_function_t)(corpus_t *corpus);
+
+typedef struct
+{
+    const char *name;
+    benchmark_function_t function;
+} benchmark_t;
+
+static volatile size_t sink;
+
+static double get_time(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+static uint64_t random_state = 0x9E3779B97F4A7C15ull;
+
+static uint32_t next_random(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return (uint32_t)(random_state >> 32);
+}
+
+static size_t put_code_point(char *dst, uint32_t cp)
+{
+    if (cp < 0x80)
+    {
+        dst[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800)
+    {
+        dst[0] = (char)(0xC0 | (cp >> 6));
+        dst[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000)
+    {
+        dst[0] = (char)(0xE0 | (cp >> 12));
+        dst[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        dst[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    dst[0] = (char)(0xF0 | (cp >> 18));
+    dst[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    dst[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    dst[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+static uint32_t get_random_code_point(corpus_type_t type)
+{
+    uint32_t r = next_random();
+    switch (type)
+    {
+        case corpus_latin:
+            return (r & 3) ? 0xC0 + (r >> 8) % 0x140 : 'a' + (r >> 8) % 26;
+        case corpus_cjk:
+            return 0x4E00 + (r >> 8) % 0x5200;
+        case corpus_emoji:
+            return 0x1F300 + (r >> 8) % 0x300;
+        default:
+            return 'a' + (r >> 8) % 26;
+    }
+}
+
+/*
+    Corpora are valid UTF-8 of exactly 'size' bytes; text corpora contain
+    a comma roughly every eight characters, 'separators' consists mostly
+    of runs of commas and 'repetitive' is a single repeated letter,
+    the worst case for naive substring search
+*/
+static string_t generate_text(corpus_type_t type, size_t size)
+{
+    char *data = malloc(size + 1);
+    size_t length = 0;
+    while (length < size)
+    {
+        char encoded[4];
+        size_t width;
+        uint32_t r = next_random();
+        if (type == corpus_repetitive)
+        {
+            encoded[0] = 'a';
+            width = 1;
+        }
+        else if (type == corpus_separators)
+        {
+            encoded[0] = (r & 15) ? ',' : 'x';
+            width = 1;
+        }
+        else if ((r & 7) == 0)
+        {
+            encoded[0] = ',';
+            width = 1;
+        }
+        else
+        {
+            width = put_code_point(encoded, get_random_code_point(type));
+        }
+        if (length + width > size)
+        {
+            encoded[0] = ' ';
+            width = 1;
+        }
+        memcpy(data + length, encoded, width);
+        length += width;
+    }
+    data[size] = '\0';
+    return init_string(data, size);
+}
+
+/*
+    Comma-separated numbers of exactly 'size' bytes for the parsers;
+    the space left after the last number is filled with commas
+*/
+static string_t generate_numbers(size_t size, bool decimal)
+{
+    char *data = malloc(size + 1);
+    size_t length = 0;
+    for (;;)
+    {
+        char number[32];
+        uint32_t r = next_random();
+        int width = decimal
+            ? snprintf(number, sizeof(number), "%.*f,", (int)(r % 7), (double)(int32_t)next_random() / 1000.0)
+            : snprintf(number, sizeof(number), "%d,", (int32_t)r >> (r & 31));
+        if (length + (size_t)width > size)
+            break;
+        memcpy(data + length, number, (size_t)width);
+        length += (size_t)width;
+    }
+    memset(data + length, ',', size - length);
+    data[size] = '\0';
+    return init_string(data, size);
+}
+
+static string_t copy_string(string_t str)
+{
+    char *data = malloc(str.length + 1);
+    memcpy(data, str.data, str.length + 1);
+    return init_string(data, str.length);
+}
+
+static wide_string_t copy_wide_string(wide_string_t wstr)
+{
+    wchar_t *data = malloc((wstr.length + 1) * sizeof(wchar_t));
+    memcpy(data, wstr.data, (wstr.length + 1) * sizeof(wchar_t));
+    return init_wide_string(data, wstr.length);
+}
+
+static char * write_temporary_file(string_t text)
+{
+    const char *directory = getenv("TMPDIR");
+    if (!directory)
+        directory = ".";
+    size_t length = strlen(directory) + 32;
+    char *file_name = malloc(length);
+    snprintf(file_name, length, "%s/strings_bench.tmp", directory);
+    FILE *stream = fopen(file_name, "wb");
+    if (!stream)
+    {
+        free(file_name);
+        return NULL;
+    }
+    fwrite(text.data, 1, text.length, stream);
+    fclose(stream);
+    return file_name;
+}
+
+static void create_corpus(corpus_t *corpus, corpus_type_t type, size_t size, bool with_file)
+{
+    corpus->text = generate_text(type, size);
+    wide_string_t *wide_text = decode_utf8_string(corpus->text);
+    corpus->wide_text = copy_wide_string(*wide_text);
+    free(wide_text);
+    corpus->copy = copy_string(corpus->text);
+    size_t needle_length = size < 16 ? size : 16;
+    corpus->needle.data = malloc(needle_length + 1);
+    memcpy(corpus->needle.data, corpus->text.data + size - needle_length, needle_length);
+    if (needle_length)
+        corpus->needle.data[needle_length - 1] = '#';
+    corpus->needle.length = needle_length;
+    corpus->separator = ',';
+    corpus->lines = copy_string(corpus->text);
+    for (size_t i = 0; i < size; i++)
+    {
+        if (corpus->lines.data[i] == corpus->separator)
+            corpus->lines.data[i] = '\n';
+    }
+    corpus->integers = generate_numbers(size, false);
+    corpus->decimals = generate_numbers(size, true);
+    corpus->scratch = copy_string(corpus->text);
+    corpus->wide_scratch = copy_wide_string(corpus->wide_text);
+    corpus->wide_copy = copy_wide_string(corpus->wide_text);
+    corpus->fields = split_string(corpus->text, corpus->separator);
+    corpus->wide_fields = split_wide_string(corpus->wide_text, (wchar_t)corpus->separator);
+    corpus->views = split_string_to_views(corpus->text, corpus->separator);
+    corpus->format = compile_format("%d: %u items, %f%%;");
+    corpus->file_name = with_file ? write_temporary_file(corpus->text) : NULL;
+}
+
+static void destroy_corpus(corpus_t *corpus)
+{
+    if (corpus->file_name)
+    {
+        remove(corpus->file_name);
+        free(corpus->file_name);
+    }
+    free(corpus->text.data);
+    free(corpus->wide_text.data);
+    free(corpus->copy.data);
+    free(corpus->needle.data);
+    free(corpus->lines.data);
+    free(corpus->integers.data);
+    free(corpus->decimals.data);
+    free(corpus->scratch.data);
+    free(corpus->wide_scratch.data);
+    free(corpus->wide_copy.data);
+    destroy_strings_list(corpus->fields);
+    destroy_wide_strings_list(corpus->wide_fields);
+    free(corpus->views);
+    free(corpus->format);
+}
+
+static void bench_append_char(corpus_t *corpus)
+{
+    string_builder_t *builder = create_string_builder(0);
+    for (size_t i = 0; i < corpus->text.length; i++)
+        builder = append_char(builder, corpus->text.data[i]);
+    sink += builder->length;
+    free(builder);
+}
+
+static void bench_append_string(corpus_t *corpus)
+{
+    string_builder_t *builder = create_string_builder(0);
+    for (size_t i = 0; i < corpus->text.length; i += 16)
+    {
+        size_t length = corpus->text.length - i < 16 ? corpus->text.length - i : 16;
+        builder = append_string(builder, init_string(corpus->text.data + i, length));
+    }
+    sink += builder->length;
+    free(builder);
+}
+
+static void bench_reserve_string_builder(corpus_t *corpus)
+{
+    string_builder_t *builder = reserve_string_builder(create_string_builder(0), corpus->text.length);
+    builder = append_string(builder, corpus->text);
+    sink += builder->capacity;
+    free(builder);
+}
+
+static void bench_shrink_string_builder(corpus_t *corpus)
+{
+    string_builder_t *builder = create_string_builder(corpus->text.length * 2);
+    builder = shrink_string_builder(append_string(builder, corpus->text));
+    sink += builder->capacity;
+    free(builder);
+}
+
+static void bench_append_wide_char(corpus_t *corpus)
+{
+    wide_string_builder_t *builder = create_wide_string_builder(0);
+    for (size_t i = 0; i < corpus->wide_text.length; i++)
+        builder = append_wide_char(builder, corpus->wide_text.data[i]);
+    sink += builder->length;
+    free(builder);
+}
+
+static void bench_append_wide_string(corpus_t *corpus)
+{
+    wide_string_builder_t *builder = create_wide_string_builder(0);
+    for (size_t i = 0; i < corpus->wide_text.length; i += 16)
+    {
+        size_t length = corpus->wide_text.length - i < 16 ? corpus->wide_text.length - i : 16;
+        builder = append_wide_string(builder, init_wide_string(corpus->wide_text.data + i, length));
+    }
+    sink += builder->length;
+    free(builder);
+}
+
+static void bench_append_non_wide_string(corpus_t *corpus)
+{
+    wide_string_builder_t *builder = create_wide_string_builder(0);
+    for (size_t i = 0; i < corpus->text.length; i += 16)
+    {
+        size_t length = corpus->text.length - i < 16 ? corpus->text.length - i : 16;
+        builder = append_non_wide_string(builder, init_string(corpus->text.data + i, length));
+    }
+    sink += builder->length;
+    free(builder);
+}
+
+static void bench_reserve_wide_string_builder(corpus_t *corpus)
+{
+    wide_string_builder_t *builder = reserve_wide_string_builder(create_wide_string_builder(0),
+        corpus->wide_text.length);
+    builder = append_wide_string(builder, corpus->wide_text);
+    sink += builder->capacity;
+    free(builder);
+}
+
+static void bench_shrink_wide_string_builder(corpus_t *corpus)
+{
+    wide_string_builder_t *builder = create_wide_string_builder(corpus->wide_text.length * 2);
+    builder = shrink_wide_string_builder(append_wide_string(builder, corpus->wide_text));
+    sink += builder->capacity;
+    free(builder);
+}
+
+static void bench_append_formatted_string(corpus_t *corpus)
+{
+    string_builder_t *builder = create_string_builder(0);
+    size_t count = corpus->text.length / 32 + 1;
+    for (size_t i = 0; i < count; i++)
+        builder = append_formatted_string(builder, "%d: %u items, %f%%;", (int)i, (unsigned int)(i * 7), i * 0.25);
+    sink += builder->length;
+    free(builder);
+}
+
+static void bench_append_formatted_wide_string(corpus_t *corpus)
+{
+    wide_string_builder_t *builder = create_wide_string_builder(0);
+    size_t count = corpus->text.length / 32 + 1;
+    for (size_t i = 0; i < count; i++)
+        builder = append_formatted_wide_string(builder, L"%d: %u items, %f%%;", (int)i, (unsigned int)(i * 7), i * 0.25);
+    sink += builder->length;
+    free(builder);
+}
+
+static void bench_compile_format(corpus_t *corpus)
+{
+    (void)corpus;
+    string_format_t *format = compile_format("%d: %u items, %f%%;");
+    sink += (size_t)(uintptr_t)format;
+    free(format);
+}
+
+static void bench_append_compiled_format(corpus_t *corpus)
+{
+    string_builder_t *builder = create_string_builder(0);
+    size_t count = corpus->text.length / 32 + 1;
+    for (size_t i = 0; i < count; i++)
+        builder = append_compiled_format(builder, corpus->format, (int)i, (unsigned int)(i * 7), i * 0.25);
+    sink += builder->length;
+    free(builder);
+}
+
+static void bench_parse_int64(corpus_t *corpus)
+{
+    const char *p = corpus->integers.data,
+        *end = p + corpus->integers.length;
+    while (p < end)
+    {
+        int64_t value = 0;
+        size_t consumed = parse_int64(init_string(p, (size_t)(end - p)), &value);
+        sink += (size_t)value;
+        p += consumed + 1;
+    }
+}
+
+static void bench_parse_uint64(corpus_t *corpus)
+{
+    const char *p = corpus->integers.data,
+        *end = p + corpus->integers.length;
+    while (p < end)
+    {
+        if (*p == '-')
+            p++;
+        uint64_t value = 0;
+        size_t consumed = parse_uint64(init_string(p, (size_t)(end - p)), &value);
+        sink += (size_t)value;
+        p += consumed + 1;
+    }
+}
+
+static void bench_parse_double(corpus_t *corpus)
+{
+    const char *p = corpus->decimals.data,
+        *end = p + corpus->decimals.length;
+    while (p < end)
+    {
+        double value = 0;
+        size_t consumed = parse_double(init_string(p, (size_t)(end - p)), &value);
+        sink += (size_t)(value > 0);
+        p += consumed + 1;
+    }
+}
+
+static void bench_duplicate_string(corpus_t *corpus)
+{
+    string_t *str = duplicate_string(corpus->text);
+    sink += str->length;
+    free(str);
+}
+
+static void bench_duplicate_wide_string(corpus_t *corpus)
+{
+    wide_string_t *wstr = duplicate_wide_string(corpus->wide_text);
+    sink += wstr->length;
+    free(wstr);
+}
+
+static void bench_decode_utf8(corpus_t *corpus)
+{
+    wide_string_t *wstr = decode_utf8_string(corpus->text);
+    sink += wstr->length;
+    free(wstr);
+}
+
+static void bench_encode_utf8(corpus_t *corpus)
+{
+    string_t *str = encode_utf8_string(corpus->wide_text);
+    sink += str->length;
+    free(str);
+}
+
+static void bench_feed_utf8_decoder(corpus_t *corpus)
+{
+    utf8_decoder_t decoder;
+    init_utf8_decoder(&decoder);
+    wide_string_builder_t *builder = create_wide_string_builder(0);
+    for (size_t i = 0; i < corpus->text.length; i += 4096)
+    {
+        size_t length = corpus->text.length - i < 4096 ? corpus->text.length - i : 4096;
+        builder = feed_utf8_decoder(&decoder, builder, init_string(corpus->text.data + i, length));
+    }
+    sink += builder->length + finish_utf8_decoder(&decoder);
+    free(builder);
+}
+
+static void bench_feed_utf8_decoder_to_buffer(corpus_t *corpus)
+{
+    wchar_t buffer[1024];
+    utf8_decoder_t decoder;
+    init_utf8_decoder(&decoder);
+    string_t rest = corpus->text;
+    while (rest.length)
+    {
+        size_t written;
+        size_t consumed = feed_utf8_decoder_to_buffer(&decoder, rest, buffer, 1024, &written);
+        sink += written;
+        rest.data += consumed;
+        rest.length -= consumed;
+    }
+    sink += finish_utf8_decoder(&decoder);
+}
+
+static void bench_utf8_validate(corpus_t *corpus)
+{
+    sink += utf8_validate(corpus->text);
+}
+
+static void bench_utf8_count_code_points(corpus_t *corpus)
+{
+    sink += utf8_count_code_points(corpus->text);
+}
+
+static void bench_utf8_offset_of_code_point(corpus_t *corpus)
+{
+    sink += utf8_offset_of_code_point(corpus->text, corpus->wide_text.length / 2);
+}
+
+static void bench_utf8_sub_string(corpus_t *corpus)
+{
+    string_t *str = utf8_sub_string(corpus->text, corpus->wide_text.length / 4, corpus->wide_text.length / 2);
+    sink += str->length;
+    free(str);
+}
+
+static void bench_calculate_utf8_length(corpus_t *corpus)
+{
+    sink += calculate_utf8_length(corpus->wide_text);
+}
+
+static void bench_encode_utf8_to_buffer(corpus_t *corpus)
+{
+    sink += encode_utf8_string_to_buffer(corpus->wide_text, corpus->scratch.data, corpus->scratch.length + 1);
+}
+
+static void bench_wide_string_to_string(corpus_t *corpus)
+{
+    bool was_bad_char;
+    string_t *str = wide_string_to_string(corpus->wide_text, '?', &was_bad_char);
+    sink += str->length + was_bad_char;
+    free(str);
+}
+
+static void bench_string_to_lower_case(corpus_t *corpus)
+{
+    string_t *str = string_to_lower_case(corpus->text);
+    sink += str->length;
+    free(str);
+}
+
+static void bench_string_to_upper_case(corpus_t *corpus)
+{
+    string_t *str = string_to_upper_case(corpus->text);
+    sink += str->length;
+    free(str);
+}
+
+static void bench_fold_string_case(corpus_t *corpus)
+{
+    string_t *str = fold_string_case(corpus->text);
+    sink += str->length;
+    free(str);
+}
+
+static void bench_string_to_lower_case_in_place(corpus_t *corpus)
+{
+    string_to_lower_case_in_place(corpus->scratch);
+    sink += (unsigned char)corpus->scratch.data[0];
+}
+
+static void bench_string_to_upper_case_in_place(corpus_t *corpus)
+{
+    string_to_upper_case_in_place(corpus->scratch);
+    sink += (unsigned char)corpus->scratch.data[0];
+}
+
+static void bench_fold_string_case_in_place(corpus_t *corpus)
+{
+    fold_string_case_in_place(corpus->scratch);
+    sink += (unsigned char)corpus->scratch.data[0];
+}
+
+static void bench_wide_string_to_lower_case(corpus_t *corpus)
+{
+    wide_string_t *wstr = wide_string_to_lower_case(corpus->wide_text);
+    sink += wstr->length;
+    free(wstr);
+}
+
+static void bench_wide_string_to_upper_case(corpus_t *corpus)
+{
+    wide_string_t *wstr = wide_string_to_upper_case(corpus->wide_text);
+    sink += wstr->length;
+    free(wstr);
+}
+
+static void bench_fold_wide_string_case(corpus_t *corpus)
+{
+    wide_string_t *wstr = fold_wide_string_case(corpus->wide_text);
+    sink += wstr->length;
+    free(wstr);
+}
+
+static void bench_wide_string_to_lower_case_in_place(corpus_t *corpus)
+{
+    wide_string_to_lower_case_in_place(corpus->wide_scratch);
+    sink += (size_t)corpus->wide_scratch.data[0];
+}
+
+static void bench_wide_string_to_upper_case_in_place(corpus_t *corpus)
+{
+    wide_string_to_upper_case_in_place(corpus->wide_scratch);
+    sink += (size_t)corpus->wide_scratch.data[0];
+}
+
+static void bench_fold_wide_string_case_in_place(corpus_t *corpus)
+{
+    fold_wide_string_case_in_place(corpus->wide_scratch);
+    sink += (size_t)corpus->wide_scratch.data[0];
+}
+
+static void bench_trim_string(corpus_t *corpus)
+{
+    sink += trim_string(corpus->text).length + trim_string_left(corpus->text).length
+        + trim_string_right(corpus->text).length;
+}
+
+static void bench_trim_wide_string(corpus_t *corpus)
+{
+    sink += trim_wide_string(corpus->wide_text).length + trim_wide_string_left(corpus->wide_text).length
+        + trim_wide_string_right(corpus->wide_text).length;
+}
+
+static void bench_sub_string(corpus_t *corpus)
+{
+    string_t *str = sub_string(corpus->text, corpus->text.length / 4, corpus->text.length / 2);
+    sink += str->length;
+    free(str);
+}
+
+static void bench_sub_wide_string(corpus_t *corpus)
+{
+    wide_string_t *wstr = sub_wide_string(corpus->wide_text, corpus->wide_text.length / 4,
+        corpus->wide_text.length / 2);
+    sink += wstr->length;
+    free(wstr);
+}
+
+static void bench_split_string(corpus_t *corpus)
+{
+    strings_list_t *list = split_string(corpus->text, corpus->separator);
+    sink += list->size;
+    destroy_strings_list(list);
+}
+
+static void bench_split_string_to_views(corpus_t *corpus)
+{
+    string_views_list_t *list = split_string_to_views(corpus->text, corpus->separator);
+    sink += list->size;
+    free(list);
+}
+
+static void bench_split_wide_string(corpus_t *corpus)
+{
+    wide_strings_list_t *list = split_wide_string(corpus->wide_text, (wchar_t)corpus->separator);
+    sink += list->size;
+    destroy_wide_strings_list(list);
+}
+
+static void bench_split_wide_string_to_views(corpus_t *corpus)
+{
+    wide_string_views_list_t *list = split_wide_string_to_views(corpus->wide_text, (wchar_t)corpus->separator);
+    sink += list->size;
+    free(list);
+}
+
+static void bench_split_next(corpus_t *corpus)
+{
+    split_state_t state = init_split_state(corpus->text, corpus->separator);
+    string_t token;
+    while (split_next(&state, &token))
+        sink += token.length;
+}
+
+static void bench_split_wide_next(corpus_t *corpus)
+{
+    wide_split_state_t state = init_wide_split_state(corpus->wide_text, (wchar_t)corpus->separator);
+    wide_string_t token;
+    while (split_wide_next(&state, &token))
+        sink += token.length;
+}
+
+static void bench_next_line(corpus_t *corpus)
+{
+    line_state_t state = init_line_state(corpus->lines);
+    string_t line;
+    while (next_line(&state, &line))
+        sink += line.length;
+}
+
+static void bench_join_strings(corpus_t *corpus)
+{
+    string_t *str = join_strings(corpus->fields, init_string(", ", 2));
+    sink += str->length;
+    free(str);
+}
+
+static void bench_join_wide_strings(corpus_t *corpus)
+{
+    wide_string_t *wstr = join_wide_strings(corpus->wide_fields, init_wide_string(L", ", 2));
+    sink += wstr->length;
+    free(wstr);
+}
+
+static void bench_concat_string_array(corpus_t *corpus)
+{
+    string_t *str = concat_string_array(corpus->views->items, corpus->views->size);
+    sink += str->length;
+    free(str);
+}
+
+static void bench_concat_strings(corpus_t *corpus)
+{
+    size_t quarter = corpus->text.length / 4;
+    string_t *str = concat_strings(4, init_string(corpus->text.data, quarter),
+        init_string(corpus->text.data + quarter, quarter), init_string(corpus->text.data + quarter * 2, quarter),
+        init_string(corpus->text.data + quarter * 3, corpus->text.length - quarter * 3));
+    sink += str->length;
+    free(str);
+}
+
+static void bench_index_of_char(corpus_t *corpus)
+{
+    sink += index_of_char_in_string(corpus->text, '#');
+}
+
+static void bench_index_of_wide_char(corpus_t *corpus)
+{
+    sink += index_of_char_in_wide_string(corpus->wide_text, L'#');
+}
+
+static void bench_last_index_of_char(corpus_t *corpus)
+{
+    sink += last_index_of_char_in_string(corpus->text, '#');
+}
+
+static void bench_last_index_of_wide_char(corpus_t *corpus)
+{
+    sink += last_index_of_char_in_wide_string(corpus->wide_text, L'#');
+}
+
+static void bench_count_of_char(corpus_t *corpus)
+{
+    sink += count_of_char_in_string(corpus->text, corpus->separator);
+}
+
+static void bench_count_of_wide_char(corpus_t *corpus)
+{
+    sink += count_of_char_in_wide_string(corpus->wide_text, (wchar_t)corpus->separator);
+}
+
+static void bench_index_of_string(corpus_t *corpus)
+{
+    sink += index_of_string(corpus->text, corpus->needle);
+}
+
+static void bench_last_index_of_string(corpus_t *corpus)
+{
+    sink += last_index_of_string(corpus->text, corpus->needle);
+}
+
+static void bench_count_of_string(corpus_t *corpus)
+{
+    sink += count_of_string(corpus->text, corpus->needle);
+}
+
+static void bench_compare_strings(corpus_t *corpus)
+{
+    sink += (size_t)compare_strings(&corpus->text, &corpus->copy);
+}
+
+static void bench_replace_all(corpus_t *corpus)
+{
+    string_builder_t *builder = replace_all(NULL, corpus->text, init_string(",", 1), init_string(", ", 2));
+    sink += builder->length;
+    free(builder);
+}
+
+static void bench_compare_wide_strings(corpus_t *corpus)
+{
+    sink += (size_t)compare_wide_strings(&corpus->wide_text, &corpus->wide_copy);
+}
+
+static void bench_compare_strings_ignore_case(corpus_t *corpus)
+{
+    sink += (size_t)compare_strings_ignore_case(&corpus->text, &corpus->copy);
+}
+
+static void bench_compare_strings_natural(corpus_t *corpus)
+{
+    sink += (size_t)compare_strings_natural(&corpus->text, &corpus->copy);
+}
+
+static void bench_are_strings_equal_ignore_case(corpus_t *corpus)
+{
+    sink += are_strings_equal_ignore_case(corpus->text, corpus->copy);
+}
+
+static void bench_hash_string(corpus_t *corpus)
+{
+    sink += (size_t)hash_string(corpus->text);
+}
+
+static void bench_read_file(corpus_t *corpus)
+{
+    string_t *str = read_file_to_string(corpus->file_name);
+    if (str)
+    {
+        sink += str->length;
+        free(str);
+    }
+}
+
+static void bench_map_file(corpus_t *corpus)
+{
+    string_t *str = map_file_to_string(corpus->file_name);
+    if (str)
+    {
+        sink += str->length;
+        unmap_string(str);
+    }
+}
+
+static const benchmark_t benchmarks[] =
+{
+    { "append_char", bench_append_char },
+    { "append_string", bench_append_string },
+    { "reserve_string_builder", bench_reserve_string_builder },
+    { "shrink_string_builder", bench_shrink_string_builder },
+    { "append_wide_char", bench_append_wide_char },
+    { "append_wide_string", bench_append_wide_string },
+    { "append_non_wide_string", bench_append_non_wide_string },
+    { "reserve_wide_string_builder", bench_reserve_wide_string_builder },
+    { "shrink_wide_string_builder", bench_shrink_wide_string_builder },
+    { "append_formatted_string", bench_append_formatted_string },
+    { "append_formatted_wide_string", bench_append_formatted_wide_string },
+    { "compile_format", bench_compile_format },
+    { "append_compiled_format", bench_append_compiled_format },
+    { "parse_int64", bench_parse_int64 },
+    { "parse_uint64", bench_parse_uint64 },
+    { "parse_double", bench_parse_double },
+    { "duplicate_string", bench_duplicate_string },
+    { "duplicate_wide_string", bench_duplicate_wide_string },
+    { "decode_utf8_string", bench_decode_utf8 },
+    { "feed_utf8_decoder", bench_feed_utf8_decoder },
+    { "feed_utf8_decoder_to_buffer", bench_feed_utf8_decoder_to_buffer },
+    { "utf8_validate", bench_utf8_validate },
+    { "utf8_count_code_points", bench_utf8_count_code_points },
+    { "utf8_offset_of_code_point", bench_utf8_offset_of_code_point },
+    { "utf8_sub_string", bench_utf8_sub_string },
+    { "encode_utf8_string", bench_encode_utf8 },
+    { "calculate_utf8_length", bench_calculate_utf8_length },
+    { "encode_utf8_string_to_buffer", bench_encode_utf8_to_buffer },
+    { "wide_string_to_string", bench_wide_string_to_string },
+    { "string_to_lower_case", bench_string_to_lower_case },
+    { "string_to_upper_case", bench_string_to_upper_case },
+    { "fold_string_case", bench_fold_string_case },
+    { "string_to_lower_case_in_place", bench_string_to_lower_case_in_place },
+    { "string_to_upper_case_in_place", bench_string_to_upper_case_in_place },
+    { "fold_string_case_in_place", bench_fold_string_case_in_place },
+    { "wide_string_to_lower_case", bench_wide_string_to_lower_case },
+    { "wide_string_to_upper_case", bench_wide_string_to_upper_case },
+    { "fold_wide_string_case", bench_fold_wide_string_case },
+    { "wide_string_to_lower_case_in_place", bench_wide_string_to_lower_case_in_place },
+    { "wide_string_to_upper_case_in_place", bench_wide_string_to_upper_case_in_place },
+    { "fold_wide_string_case_in_place", bench_fold_wide_string_case_in_place },
+    { "trim_string", bench_trim_string },
+    { "trim_wide_string", bench_trim_wide_string },
+    { "sub_string", bench_sub_string },
+    { "sub_wide_string", bench_sub_wide_string },
+    { "split_string", bench_split_string },
+    { "split_wide_string", bench_split_wide_string },
+    { "split_string_to_views", bench_split_string_to_views },
+    { "split_wide_string_to_views", bench_split_wide_string_to_views },
+    { "split_next", bench_split_next },
+    { "split_wide_next", bench_split_wide_next },
+    { "next_line", bench_next_line },
+    { "join_strings", bench_join_strings },
+    { "join_wide_strings", bench_join_wide_strings },
+    { "concat_string_array", bench_concat_string_array },
+    { "concat_strings", bench_concat_strings },
+    { "index_of_char_in_string", bench_index_of_char },
+    { "index_of_char_in_wide_string", bench_index_of_wide_char },
+    { "last_index_of_char_in_string", bench_last_index_of_char },
+    { "last_index_of_char_in_wide_string", bench_last_index_of_wide_char },
+    { "count_of_char_in_string", bench_count_of_char },
+    { "count_of_char_in_wide_string", bench_count_of_wide_char },
+    { "index_of_string", bench_index_of_string },
+    { "last_index_of_string", bench_last_index_of_string },
+    { "count_of_string", bench_count_of_string },
+    { "replace_all", bench_replace_all },
+    { "compare_strings", bench_compare_strings },
+    { "compare_wide_strings", bench_compare_wide_strings },
+    { "compare_strings_ignore_case", bench_compare_strings_ignore_case },
+    { "compare_strings_natural", bench_compare_strings_natural },
+    { "are_strings_equal_ignore_case", bench_are_strings_equal_ignore_case },
+    { "hash_string", bench_hash_string },
+    { "read_file_to_string", bench_read_file },
+    { "map_file_to_string", bench_map_file }
+};
+
+static bool is_file_benchmark(const benchmark_t *benchmark)
+{
+    return benchmark->function == bench_read_file || benchmark->function == bench_map_file;
+}
+
+/*
+    The benchmark is repeated until 'min_time' seconds elapse; short calls
+    are timed in batches that double until a batch takes at least
+    ten microseconds, so the timer overhead does not distort the result;
+    the fastest batch gives the latency estimate, the mean gives the throughput
+*/
+static void run_benchmark(const benchmark_t *benchmark, corpus_type_t type, corpus_t *corpus,
+    double min_time, bool *first)
+{
+    size_t iterations = 0,
+        batch = 1;
+    double fastest = 0, total = 0;
+    do
+    {
+        double start = get_time();
+        for (size_t i = 0; i < batch; i++)
+            benchmark->function(corpus);
+        double elapsed = get_time() - start;
+        double per_call = elapsed / (double)batch;
+        if (!iterations || per_call < fastest)
+            fastest = per_call;
+        total += elapsed;
+        iterations += batch;
+        if (elapsed < 1e-5)
+            batch *= 2;
+    } while (total < min_time);
+    double mean = total / (double)iterations;
+    printf("%s\n  {\"benchmark\": \"%s\", \"corpus\": \"%s\", \"size\": %zu, \"iterations\": %zu, "
+        "\"min_ns\": %.1f, \"mean_ns\": %.1f, \"mb_per_s\": %.2f}",
+        *first ? "" : ",", benchmark->name, corpus_names[type], corpus->text.length, iterations,
+        fastest * 1e9, mean * 1e9, mean > 0 ? (double)corpus->text.length / mean / 1e6 : 0.0);
+    *first = false;
+    fflush(stdout);
+}
+
+static bool matches_filter(const benchmark_t *benchmark, const char *filter)
+{
+    return !filter || strstr(benchmark->name, filter) != NULL;
+}
+
+int main(int argc, char **argv)
+{
+    size_t max_size = 16 * 1024 * 1024;
+    double min_time = 0.1;
+    const char *filter = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (0 == strcmp(argv[i], "--max-size") && i + 1 < argc)
+            max_size = (size_t)strtoull(argv[++i], NULL, 10);
+        else if (0 == strcmp(argv[i], "--min-time") && i + 1 < argc)
+            min_time = strtod(argv[++i], NULL);
+        else if (0 == strcmp(argv[i], "--filter") && i + 1 < argc)
+            filter = argv[++i];
+        else
+        {
+            fprintf(stderr, "usage: %s [--max-size BYTES] [--min-time SECONDS] [--filter NAME]\n", argv[0]);
+            return 1;
+        }
+    }
+    const size_t benchmark_count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+    bool with_files = false;
+    for (size_t k = 0; k < benchmark_count; k++)
+    {
+        if (is_file_benchmark(&benchmarks[k]) && matches_filter(&benchmarks[k], filter))
+            with_files = true;
+    }
+    bool first = true;
+    printf("[");
+    for (size_t size = 16; size <= max_size; size *= 4)
+    {
+        for (int type = 0; type < corpus_count; type++)
+        {
+            corpus_t corpus;
+            create_corpus(&corpus, (corpus_type_t)type, size, with_files);
+            for (size_t k = 0; k < benchmark_count; k++)
+            {
+                const benchmark_t *benchmark = &benchmarks[k];
+                if (!matches_filter(benchmark, filter))
+                    continue;
+                if (is_file_benchmark(benchmark) && !corpus.file_name)
+                    continue;
+                run_benchmark(benchmark, (corpus_type_t)type, &corpus, min_time, &first);
+            }
+            destroy_corpus(&corpus);
+        }
+        if (size > SIZE_MAX / 4)
+            break;
+    }
+    printf("\n]\n");
+    return 0;
+}
@@ -0,0 +1,41 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    The declaration of the concurrent append buffer: a bounded ring
+    into which any number of threads append without locks; a producer
+    reserves a byte range, fills it and commits it, and a single consumer
+    takes the longest prefix of committed data in the order of reservation
+*/
+
+#pragma once
+
+#include "strings.h"
+
+typedef struct concurrent_buffer_t concurrent_buffer_t;
+
+/*
+    The reserved range is split in two views if it wraps around
+    the end of the ring; 'second' is empty otherwise
+*/
+typedef struct
+{
+    string_t first;
+    string_t second;
+    uint64_t position;
+} concurrent_reservation_t;
+
+concurrent_buffer_t * create_concurrent_buffer(size_t capacity);
+void destroy_concurrent_buffer(concurrent_buffer_t *buffer);
+bool reserve_in_concurrent_buffer(concurrent_buffer_t *buffer, size_t length, concurrent_reservation_t *reservation);
+void commit_to_concurrent_buffer(concurrent_buffer_t *buffer, const concurrent_reservation_t *reservation);
+bool append_to_concurrent_buffer(concurrent_buffer_t *buffer, string_t str);
+size_t peek_concurrent_buffer(concurrent_buffer_t *buffer, string_t *first, string_t *second);
+void consume_concurrent_buffer(concurrent_buffer_t *buffer, size_t length);
+string_builder_t * drain_concurrent_buffer(concurrent_buffer_t *buffer, string_builder_t *obj);
+
+static __inline void write_to_reservation(const concurrent_reservation_t *reservation, string_t str)
+{
+    size_t length = str.length < reservation->first.length ? str.length : reservation->first.length;
+    memcpy(reservation->first.data, str.data, length);
+    memcpy(reservation->second.data, str.data + length, str.length - length);
+}
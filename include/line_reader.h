@@ -0,0 +1,33 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    The declaration of the line reader: a file is read in blocks into
+    a sliding window, and lines are returned as views into this window,
+    so the memory used does not depend on the size of the file
+*/
+
+#pragma once
+
+#include "strings.h"
+
+typedef struct
+{
+    int fd;
+    bool owns_fd;
+    bool end_of_file;
+    bool failed;
+    char *buffer;
+    size_t capacity;
+    size_t begin;
+    size_t end;
+} line_reader_t;
+
+line_reader_t * open_line_reader(const char *file_name, size_t block_size);
+line_reader_t * create_line_reader(int fd, size_t block_size);
+void destroy_line_reader(line_reader_t *reader);
+bool read_next_line(line_reader_t *reader, string_t *line);
+
+static __inline bool has_line_reader_failed(const line_reader_t *reader)
+{
+    return reader->failed;
+}
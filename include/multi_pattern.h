@@ -0,0 +1,38 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    The declaration of the multi-pattern matcher (Aho-Corasick automaton):
+    all patterns are searched for in a single pass over the text;
+    matches are leftmost-longest and do not overlap
+*/
+
+#pragma once
+
+#include "strings.h"
+
+typedef struct multi_pattern_t multi_pattern_t;
+
+typedef struct
+{
+    size_t index;
+    size_t length;
+    size_t pattern;
+} pattern_match_t;
+
+typedef struct
+{
+    pattern_match_t * items;
+    size_t size;
+} pattern_matches_list_t;
+
+multi_pattern_t * compile_multi_pattern(const string_t *patterns, size_t count);
+multi_pattern_t * compile_wide_multi_pattern(const wide_string_t *patterns, size_t count);
+void destroy_multi_pattern(multi_pattern_t *matcher);
+bool find_next_pattern(const multi_pattern_t *matcher, string_t str, size_t start, pattern_match_t *match);
+bool find_next_wide_pattern(const multi_pattern_t *matcher, wide_string_t wstr, size_t start, pattern_match_t *match);
+pattern_matches_list_t * find_all_patterns(const multi_pattern_t *matcher, string_t str);
+pattern_matches_list_t * find_all_wide_patterns(const multi_pattern_t *matcher, wide_string_t wstr);
+string_builder_t * replace_patterns(string_builder_t *obj, const multi_pattern_t *matcher, string_t str,
+    const string_t *replacements);
+wide_string_builder_t * replace_wide_patterns(wide_string_builder_t *obj, const multi_pattern_t *matcher,
+    wide_string_t wstr, const wide_string_t *replacements);
@@ -0,0 +1,14 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    The declaration of multi-threaded variants of the string functions
+    intended for very large buffers; the results are identical to those
+    of the serial functions
+*/
+
+#pragma once
+
+#include "strings.h"
+
+size_t parallel_count_char(string_t str, char ch, size_t thread_count);
+strings_list_t * parallel_split_string(string_t str, char separator, size_t thread_count);
@@ -0,0 +1,67 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    The declaration of the shared string: an immutable string whose
+    buffer carries an atomic reference counter, so copying it to another
+    owner (or thread) costs an increment, and substrings share the buffer
+    of their parent instead of copying the characters
+*/
+
+#pragma once
+
+#include "strings.h"
+
+typedef struct shared_buffer_t shared_buffer_t;
+
+typedef struct
+{
+    shared_buffer_t *buffer;
+    string_t view;
+} shared_string_t;
+
+typedef struct
+{
+    shared_buffer_t *buffer;
+    wide_string_t view;
+} shared_wide_string_t;
+
+shared_string_t make_shared_string(string_t str);
+shared_wide_string_t make_shared_wide_string(wide_string_t wstr);
+void retain_shared_buffer(shared_buffer_t *buffer);
+void release_shared_buffer(shared_buffer_t *buffer);
+size_t get_shared_buffer_reference_count(const shared_buffer_t *buffer);
+
+static __inline shared_string_t retain_shared_string(shared_string_t str)
+{
+    retain_shared_buffer(str.buffer);
+    return str;
+}
+
+static __inline void release_shared_string(shared_string_t str)
+{
+    release_shared_buffer(str.buffer);
+}
+
+static __inline shared_wide_string_t retain_shared_wide_string(shared_wide_string_t wstr)
+{
+    retain_shared_buffer(wstr.buffer);
+    return wstr;
+}
+
+static __inline void release_shared_wide_string(shared_wide_string_t wstr)
+{
+    release_shared_buffer(wstr.buffer);
+}
+
+static __inline string_t shared_string_to_view(shared_string_t str)
+{
+    return str.view;
+}
+
+static __inline wide_string_t shared_wide_string_to_view(shared_wide_string_t wstr)
+{
+    return wstr.view;
+}
+
+shared_string_t shared_sub_string(shared_string_t str, size_t index, size_t length);
+shared_wide_string_t shared_sub_wide_string(shared_wide_string_t wstr, size_t index, size_t length);
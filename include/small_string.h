@@ -0,0 +1,51 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    The declaration of the small string, a companion type for string_t
+    which keeps short contents inline and allocates memory only for
+    strings longer than SMALL_STRING_CAPACITY characters
+*/
+
+#pragma once
+
+#include "strings.h"
+
+#define SMALL_STRING_CAPACITY 15
+
+typedef struct
+{
+    size_t length;
+    union
+    {
+        char *data;
+        char buffer[SMALL_STRING_CAPACITY + 1];
+    } content;
+} small_string_t;
+
+typedef struct
+{
+    small_string_t * items;
+    size_t size;
+} small_strings_list_t;
+
+static __inline bool is_small_string_inline(const small_string_t *sstr)
+{
+    return sstr->length <= SMALL_STRING_CAPACITY;
+}
+
+static __inline const char * get_small_string_data(const small_string_t *sstr)
+{
+    return is_small_string_inline(sstr) ? sstr->content.buffer : sstr->content.data;
+}
+
+static __inline string_t small_string_to_view(const small_string_t *sstr)
+{
+    return init_string(get_small_string_data(sstr), sstr->length);
+}
+
+small_string_t make_small_string(string_t str);
+small_string_t make_small_sub_string(string_t str, size_t index, size_t length);
+void destroy_small_string(small_string_t *sstr);
+string_t * small_string_to_string(const small_string_t *sstr);
+small_strings_list_t * split_string_to_small_strings(string_t str, char separator);
+void destroy_small_strings_list(small_strings_list_t *list);
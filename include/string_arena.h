@@ -0,0 +1,53 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    The declaration of the arena (bump-pointer allocator) for strings:
+    everything allocated in an arena is released at once by resetting
+    or destroying the arena, never by 'free'
+*/
+
+#pragma once
+
+#include "strings.h"
+
+#define STRING_ARENA_ALIGNMENT sizeof(void*)
+
+typedef struct string_arena_chunk_t string_arena_chunk_t;
+
+typedef struct
+{
+    string_arena_chunk_t *first;
+    string_arena_chunk_t *current;
+    char *top;
+    char *end;
+    size_t chunk_size;
+} string_arena_t;
+
+string_arena_t * create_string_arena(size_t chunk_size);
+void destroy_string_arena(string_arena_t *arena);
+void reset_string_arena(string_arena_t *arena);
+void * allocate_in_new_arena_chunk(string_arena_t *arena, size_t size);
+
+static __inline void * allocate_in_arena(string_arena_t *arena, size_t size)
+{
+    size = (size + STRING_ARENA_ALIGNMENT - 1) & ~(STRING_ARENA_ALIGNMENT - 1);
+    if ((size_t)(arena->end - arena->top) < size)
+        return allocate_in_new_arena_chunk(arena, size);
+    void *block = arena->top;
+    arena->top += size;
+    return block;
+}
+
+string_t * duplicate_string_in_arena(string_arena_t *arena, string_t str);
+wide_string_t * duplicate_wide_string_in_arena(string_arena_t *arena, wide_string_t wstr);
+string_t * sub_string_in_arena(string_arena_t *arena, string_t str, size_t index, size_t length);
+wide_string_t * sub_wide_string_in_arena(string_arena_t *arena, wide_string_t wstr, size_t index, size_t length);
+strings_list_t * split_string_in_arena(string_arena_t *arena, string_t str, char separator);
+wide_strings_list_t * split_wide_string_in_arena(string_arena_t *arena, wide_string_t wstr, wchar_t separator);
+string_t * wide_string_to_string_in_arena(string_arena_t *arena, wide_string_t wstr, char bad_char, bool *was_bad_char);
+string_builder_t * create_string_builder_in_arena(string_arena_t *arena, size_t capacity);
+wide_string_builder_t * create_wide_string_builder_in_arena(string_arena_t *arena, size_t capacity);
+string_builder_t * append_char_in_arena(string_arena_t *arena, string_builder_t *obj, char ch);
+wide_string_builder_t * append_wide_char_in_arena(string_arena_t *arena, wide_string_builder_t *obj, wchar_t ch);
+string_builder_t * append_string_in_arena(string_arena_t *arena, string_builder_t *obj, string_t str);
+wide_string_builder_t * append_wide_string_in_arena(string_arena_t *arena, wide_string_builder_t *obj, wide_string_t wstr);
@@ -0,0 +1,42 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    The declaration of the pool of interned strings: equal contents
+    are mapped to one canonical object, so interned strings are
+    compared by pointer and carry their precomputed hash
+*/
+
+#pragma once
+
+#include "strings.h"
+#include "string_arena.h"
+
+typedef struct
+{
+    string_t str;
+    uint64_t hash;
+} interned_string_t;
+
+typedef struct
+{
+    uint64_t hash;
+    interned_string_t *item;
+} string_pool_slot_t;
+
+typedef struct
+{
+    string_pool_slot_t *slots;
+    size_t capacity;
+    size_t count;
+    string_arena_t *arena;
+} string_pool_t;
+
+string_pool_t * create_string_pool(size_t capacity);
+void destroy_string_pool(string_pool_t *pool);
+const interned_string_t * intern_string(string_pool_t *pool, string_t str);
+const interned_string_t * find_interned_string(const string_pool_t *pool, string_t str);
+
+static __inline bool are_interned_strings_equal(const interned_string_t *first, const interned_string_t *second)
+{
+    return first == second;
+}
@@ -0,0 +1,41 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    The declaration of the rope, a string builder that stores its content
+    in a list of chunks: appending never moves data already written,
+    concatenation of ropes is O(1), and the content is flattened
+    or written to a file only on demand
+*/
+
+#pragma once
+
+#include "strings.h"
+
+typedef struct string_rope_chunk_t string_rope_chunk_t;
+
+typedef struct
+{
+    string_rope_chunk_t *first;
+    string_rope_chunk_t *last;
+    size_t length;
+    size_t chunk_size;
+    string_builder_t *scratch;
+} string_rope_t;
+
+string_rope_t * create_string_rope(size_t chunk_size);
+void destroy_string_rope(string_rope_t *rope);
+string_rope_t * append_char_to_rope(string_rope_t *rope, char ch);
+string_rope_t * append_string_to_rope(string_rope_t *rope, string_t str);
+string_rope_t * append_formatted_string_to_rope_ext(string_rope_t *rope, const char *format, va_list arg_list);
+string_rope_t * concat_ropes(string_rope_t *rope, string_rope_t *tail);
+string_t * flatten_rope(const string_rope_t *rope);
+bool write_rope_to_file(const string_rope_t *rope, int fd);
+
+static __inline string_rope_t * append_formatted_string_to_rope(string_rope_t *rope, const char *format, ...)
+{
+    va_list arg_list;
+    va_start(arg_list, format);
+    string_rope_t *result = append_formatted_string_to_rope_ext(rope, format, arg_list);
+    va_end(arg_list);
+    return result;
+}
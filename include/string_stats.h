@@ -0,0 +1,70 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    The declaration of allocation and copy statistics of the 'strings'
+    library; the counters are collected only if the library is compiled
+    with STRINGS_STATS defined, otherwise all of them stay zero
+*/
+
+#pragma once
+
+#include "strings.h"
+
+typedef enum
+{
+    STRING_STATS_CREATE_BUILDER,
+    STRING_STATS_RESERVE,
+    STRING_STATS_SHRINK,
+    STRING_STATS_APPEND_CHAR,
+    STRING_STATS_APPEND_STRING,
+    STRING_STATS_FORMAT,
+    STRING_STATS_COMPILE_FORMAT,
+    STRING_STATS_COMPILED_FORMAT,
+    STRING_STATS_DUPLICATE,
+    STRING_STATS_DECODE_UTF8,
+    STRING_STATS_ENCODE_UTF8,
+    STRING_STATS_READ_FILE,
+    STRING_STATS_MAP_FILE,
+    STRING_STATS_WIDE_TO_NARROW,
+    STRING_STATS_SUB_STRING,
+    STRING_STATS_SPLIT,
+    STRING_STATS_SPLIT_TO_VIEWS,
+    STRING_STATS_CHANGE_CASE,
+    STRING_STATS_JOIN,
+    STRING_STATS_FUNCTION_COUNT
+} string_stats_function_t;
+
+#define STRING_STATS_HISTOGRAM_SIZE 65
+
+typedef struct
+{
+    uint64_t allocations;
+    uint64_t bytes_allocated;
+    uint64_t bytes_copied;
+    uint64_t bytes_wasted;
+} string_stats_counters_t;
+
+/*
+    Wide variants are counted together with the narrow ones; everything
+    a function does through other functions of the library (e.g. the
+    'append_*' calls made by formatting) is counted for the outermost one.
+    'bytes_copied' is the content moved when a builder grows and its block
+    has to be relocated, 'bytes_wasted' is the unused capacity of builders
+    at the moment they are shrunk or turned into a final string
+    ('create_formatted_*' and 'map_file_to_string'); builders returned
+    by 'append_*' are not counted, since they may still grow.
+    Bucket 0 of the histogram counts builders of zero capacity,
+    bucket k counts capacities from 2^(k-1) to 2^k - 1
+*/
+typedef struct
+{
+    string_stats_counters_t functions[STRING_STATS_FUNCTION_COUNT];
+    uint64_t capacity_histogram[STRING_STATS_HISTOGRAM_SIZE];
+} string_stats_t;
+
+bool are_string_stats_enabled(void);
+const char * get_string_stats_function_name(string_stats_function_t function);
+void get_thread_string_stats(string_stats_t *stats);
+void get_string_stats(string_stats_t *stats);
+void reset_thread_string_stats(void);
+string_t * dump_string_stats(const string_stats_t *stats);
@@ -11,6 +11,7 @@
 #include <wchar.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef struct
 {
@@ -68,8 +69,56 @@ typedef struct
     size_t size;
 } wide_strings_list_t;
 
+typedef struct
+{
+    string_t * items;
+    size_t size;
+} string_views_list_t;
+
+typedef struct
+{
+    wide_string_t * items;
+    size_t size;
+} wide_string_views_list_t;
+
+typedef struct
+{
+    string_t rest;
+    char separator;
+    bool finished;
+} split_state_t;
+
+typedef struct
+{
+    wide_string_t rest;
+    wchar_t separator;
+    bool finished;
+} wide_split_state_t;
+
+typedef struct
+{
+    string_t rest;
+} line_state_t;
+
+typedef struct
+{
+    unsigned char pending[4];
+    unsigned int pending_length;
+    size_t offset;
+    size_t error_offset;
+} utf8_decoder_t;
+
+typedef struct string_format_t string_format_t;
+
+typedef size_t (*string_builder_growth_policy_t)(size_t capacity, size_t required);
+
+void set_string_builder_growth_policy(string_builder_growth_policy_t policy);
 string_builder_t * create_string_builder(size_t capacity);
 wide_string_builder_t * create_wide_string_builder(size_t capacity);
+string_builder_t * reserve_string_builder(string_builder_t *obj, size_t capacity);
+wide_string_builder_t * reserve_wide_string_builder(wide_string_builder_t *obj, size_t capacity);
+string_builder_t * shrink_string_builder(string_builder_t *obj);
+wide_string_builder_t * shrink_wide_string_builder(wide_string_builder_t *obj);
 string_builder_t * append_char(string_builder_t *obj, char ch);
 wide_string_builder_t * append_wide_char(wide_string_builder_t *obj, wchar_t ch);
 string_builder_t * append_string(string_builder_t *obj, string_t str);
@@ -77,8 +126,18 @@ wide_string_builder_t * append_non_wide_string(wide_string_builder_t *obj, strin
 wide_string_builder_t * append_wide_string(wide_string_builder_t *obj, wide_string_t str);
 string_builder_t * append_formatted_string_ext(string_builder_t *obj, const char *format, va_list arg_list);
 wide_string_builder_t * append_formatted_wide_string_ext(wide_string_builder_t *obj, const wchar_t *format, va_list arg_list);
+string_t * create_formatted_string_ext(const char *format, va_list arg_list);
+wide_string_t * create_formatted_wide_string_ext(const wchar_t *format, va_list arg_list);
+string_format_t * compile_format(const char *format);
+string_builder_t * append_compiled_format_ext(string_builder_t *obj, const string_format_t *format, va_list arg_list);
+uint64_t hash_string(string_t str);
+size_t parse_int64(string_t str, int64_t *value);
+size_t parse_uint64(string_t str, uint64_t *value);
+size_t parse_double(string_t str, double *value);
 int compare_strings(string_t *first, string_t *second);
 int compare_wide_strings(wide_string_t *first, wide_string_t *second);
+int compare_strings_ignore_case(string_t *first, string_t *second);
+int compare_strings_natural(string_t *first, string_t *second);
 string_t * duplicate_string(string_t str);
 wide_string_t * duplicate_wide_string(wide_string_t str);
 
@@ -86,18 +145,18 @@ static __inline string_t * create_formatted_string(const char *format, ...)
 {
     va_list arg_list;
     va_start(arg_list, format);
-    string_builder_t *result = append_formatted_string_ext(NULL, format, arg_list);
+    string_t *result = create_formatted_string_ext(format, arg_list);
     va_end(arg_list);
-    return (string_t*)result;
+    return result;
 }
 
 static __inline wide_string_t * create_formatted_wide_string(const wchar_t *format, ...)
 {
     va_list arg_list;
     va_start(arg_list, format);
-    wide_string_builder_t *result = append_formatted_wide_string_ext(NULL, format, arg_list);
+    wide_string_t *result = create_formatted_wide_string_ext(format, arg_list);
     va_end(arg_list);
-    return (wide_string_t*)result;
+    return result;
 }
 
 static __inline string_builder_t * append_formatted_string(string_builder_t *obj, const char *format, ...)
@@ -118,25 +177,149 @@ static __inline wide_string_builder_t * append_formatted_wide_string(wide_string
     return result;
 }
 
+static __inline string_builder_t * append_compiled_format(string_builder_t *obj, const string_format_t *format, ...)
+{
+    va_list arg_list;
+    va_start(arg_list, format);
+    string_builder_t *result = append_compiled_format_ext(obj, format, arg_list);
+    va_end(arg_list);
+    return result;
+}
+
 static __inline bool are_strings_equal(string_t first, string_t second)
 {
-    return first.length == second.length && 0 == strcmp(first.data, second.data);
+    return first.length == second.length
+        && (first.length == 0 || 0 == memcmp(first.data, second.data, first.length * sizeof(char)));
 }
 
 static __inline bool are_wide_strings_equal(wide_string_t first, wide_string_t second)
 {
-    return first.length == second.length && 0 == wcscmp(first.data, second.data);
+    return first.length == second.length
+        && (first.length == 0 || 0 == wmemcmp(first.data, second.data, first.length));
+}
+
+static __inline bool string_starts_with(string_t str, string_t prefix)
+{
+    return str.length >= prefix.length
+        && (prefix.length == 0 || 0 == memcmp(str.data, prefix.data, prefix.length * sizeof(char)));
+}
+
+static __inline bool string_ends_with(string_t str, string_t suffix)
+{
+    return str.length >= suffix.length
+        && (suffix.length == 0 || 0 == memcmp(str.data + str.length - suffix.length, suffix.data, suffix.length * sizeof(char)));
+}
+
+static __inline bool wide_string_starts_with(wide_string_t wstr, wide_string_t prefix)
+{
+    return wstr.length >= prefix.length
+        && (prefix.length == 0 || 0 == wmemcmp(wstr.data, prefix.data, prefix.length));
+}
+
+static __inline bool wide_string_ends_with(wide_string_t wstr, wide_string_t suffix)
+{
+    return wstr.length >= suffix.length
+        && (suffix.length == 0 || 0 == wmemcmp(wstr.data + wstr.length - suffix.length, suffix.data, suffix.length));
+}
+
+bool are_strings_equal_ignore_case(string_t first, string_t second);
+
+static __inline void init_utf8_decoder(utf8_decoder_t *decoder)
+{
+    decoder->pending_length = 0;
+    decoder->offset = 0;
+    decoder->error_offset = SIZE_MAX;
+}
+
+static __inline bool has_utf8_decoder_failed(const utf8_decoder_t *decoder)
+{
+    return decoder->error_offset != SIZE_MAX;
 }
 
 wide_string_t * decode_utf8_string(string_t str);
+wide_string_builder_t * feed_utf8_decoder(utf8_decoder_t *decoder, wide_string_builder_t *obj, string_t chunk);
+size_t feed_utf8_decoder_to_buffer(utf8_decoder_t *decoder, string_t chunk, wchar_t *buffer, size_t buffer_size,
+    size_t *written);
+bool finish_utf8_decoder(utf8_decoder_t *decoder);
+bool utf8_validate(string_t str);
+size_t utf8_count_code_points(string_t str);
+size_t utf8_offset_of_code_point(string_t str, size_t index);
+string_t * utf8_sub_string(string_t str, size_t index, size_t length);
 string_t * encode_utf8_string(wide_string_t wstr);
+size_t calculate_utf8_length(wide_string_t wstr);
+size_t encode_utf8_string_to_buffer(wide_string_t wstr, char *buffer, size_t buffer_size);
+string_t * string_to_lower_case(string_t str);
+string_t * string_to_upper_case(string_t str);
+string_t * fold_string_case(string_t str);
+/* the narrow in-place conversions change ASCII letters only, other bytes are kept */
+void string_to_lower_case_in_place(string_t str);
+void string_to_upper_case_in_place(string_t str);
+void fold_string_case_in_place(string_t str);
+wide_string_t * wide_string_to_lower_case(wide_string_t wstr);
+wide_string_t * wide_string_to_upper_case(wide_string_t wstr);
+wide_string_t * fold_wide_string_case(wide_string_t wstr);
+void wide_string_to_lower_case_in_place(wide_string_t wstr);
+void wide_string_to_upper_case_in_place(wide_string_t wstr);
+void fold_wide_string_case_in_place(wide_string_t wstr);
+string_t trim_string(string_t str);
+string_t trim_string_left(string_t str);
+string_t trim_string_right(string_t str);
+wide_string_t trim_wide_string(wide_string_t wstr);
+wide_string_t trim_wide_string_left(wide_string_t wstr);
+wide_string_t trim_wide_string_right(wide_string_t wstr);
 string_t * read_file_to_string(const char *file_name);
+string_t * map_file_to_string(const char *file_name);
+void unmap_string(string_t *str);
 string_t * wide_string_to_string(wide_string_t wstr, char bad_char, bool *was_bad_char);
 string_t * sub_string(string_t str, size_t index, size_t length);
 wide_string_t * sub_wide_string(wide_string_t wstr, size_t index, size_t length);
 size_t index_of_char_in_string(string_t str, char ch);
 size_t index_of_char_in_wide_string(wide_string_t wstr, wchar_t ch);
+size_t last_index_of_char_in_string(string_t str, char ch);
+size_t last_index_of_char_in_wide_string(wide_string_t wstr, wchar_t ch);
+size_t count_of_char_in_string(string_t str, char ch);
+size_t count_of_char_in_wide_string(wide_string_t wstr, wchar_t ch);
+size_t index_of_string(string_t haystack, string_t needle);
+size_t last_index_of_string(string_t haystack, string_t needle);
+size_t count_of_string(string_t haystack, string_t needle);
+string_builder_t * replace_all(string_builder_t *obj, string_t str, string_t pattern, string_t replacement);
 void destroy_strings_list(strings_list_t *list);
 void destroy_wide_strings_list(wide_strings_list_t *list);
 strings_list_t * split_string(string_t str, char separator);
-wide_strings_list_t * split_wide_string(wide_string_t wstr, wchar_t separator);
\ No newline at end of file
+wide_strings_list_t * split_wide_string(wide_string_t wstr, wchar_t separator);
+string_views_list_t * split_string_to_views(string_t str, char separator);
+wide_string_views_list_t * split_wide_string_to_views(wide_string_t wstr, wchar_t separator);
+string_t * join_strings(strings_list_t *list, string_t separator);
+wide_string_t * join_wide_strings(wide_strings_list_t *list, wide_string_t separator);
+string_t * concat_string_array(const string_t *items, size_t count);
+string_t * concat_strings_ext(size_t count, va_list arg_list);
+bool split_next(split_state_t *state, string_t *token);
+bool split_wide_next(wide_split_state_t *state, wide_string_t *token);
+bool next_line(line_state_t *state, string_t *line);
+
+static __inline split_state_t init_split_state(string_t str, char separator)
+{
+    split_state_t state = { str, separator, str.length == 0 };
+    return state;
+}
+
+static __inline wide_split_state_t init_wide_split_state(wide_string_t wstr, wchar_t separator)
+{
+    wide_split_state_t state = { wstr, separator, wstr.length == 0 };
+    return state;
+}
+
+static __inline line_state_t init_line_state(string_t str)
+{
+    line_state_t state = { str };
+    return state;
+}
+
+static __inline string_t * concat_strings(size_t count, ...)
+{
+    va_list arg_list;
+    va_start(arg_list, count);
+    string_t *result = concat_strings_ext(count, arg_list);
+    va_end(arg_list);
+    return result;
+}
\ No newline at end of file
@@ -0,0 +1,57 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    The declaration of the tokenizer splitting a string by a set of separators
+    with optional quoting (CSV, TSV, whitespace-separated text)
+*/
+
+#pragma once
+
+#include "strings.h"
+
+#define TOKENIZER_MAX_VECTOR_SET 8
+
+typedef struct
+{
+    unsigned char table[256];
+    unsigned char low_nibbles[16];
+    unsigned char high_nibbles[16];
+    unsigned char members[TOKENIZER_MAX_VECTOR_SET];
+    unsigned int count;
+} tokenizer_byte_set_t;
+
+/*
+    A field starting with 'quote' lasts until the closing quote; inside it,
+    the quote is written twice or preceded by 'escape' to be taken literally.
+    '\0' as 'quote' disables quoting, '\0' or the quote itself as 'escape'
+    means quotes are escaped by doubling
+*/
+typedef struct
+{
+    tokenizer_byte_set_t separators;
+    tokenizer_byte_set_t quoting;
+    char quote;
+    char escape;
+    bool skip_empty;
+} tokenizer_t;
+
+typedef struct
+{
+    string_t rest;
+    bool finished;
+    string_builder_t *scratch;
+    const char *block;
+    uint64_t block_mask;
+} tokenizer_state_t;
+
+void init_tokenizer(tokenizer_t *tokenizer, string_t separators, char quote, char escape, bool skip_empty);
+bool tokenize_next(const tokenizer_t *tokenizer, tokenizer_state_t *state, string_t *token);
+void destroy_tokenizer_state(tokenizer_state_t *state);
+string_views_list_t * tokenize_string_to_views(const tokenizer_t *tokenizer, string_t str);
+strings_list_t * tokenize_string(const tokenizer_t *tokenizer, string_t str);
+
+static __inline tokenizer_state_t init_tokenizer_state(string_t str)
+{
+    tokenizer_state_t state = { str, str.length == 0, NULL, NULL, 0 };
+    return state;
+}
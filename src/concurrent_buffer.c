@@ -0,0 +1,157 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    The implementation of the concurrent append buffer. Positions grow
+    monotonically and are mapped onto the ring modulo its capacity.
+    The ring is divided into blocks, and each block counts the bytes
+    committed into it: the consumer reads the counter of a block before
+    the reservation position, so if the counter equals the number of bytes
+    reserved in the block, every reservation in it has been committed
+*/
+
+#include "concurrent_buffer.h"
+#include "allocator.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#define BLOCK_SHIFT 12
+#define BLOCK_SIZE ((size_t)1 << BLOCK_SHIFT)
+
+struct concurrent_buffer_t
+{
+    _Atomic uint64_t head;
+    char head_padding[64 - sizeof(uint64_t)];
+    _Atomic uint64_t tail;
+    char tail_padding[64 - sizeof(uint64_t)];
+    size_t capacity;
+    size_t block_count;
+    _Atomic size_t *committed;
+    char *data;
+};
+
+concurrent_buffer_t * create_concurrent_buffer(size_t capacity)
+{
+    size_t rounded = BLOCK_SIZE * 2;
+    while (rounded < capacity + BLOCK_SIZE)
+        rounded *= 2;
+    size_t block_count = rounded >> BLOCK_SHIFT;
+    concurrent_buffer_t *buffer = nnalloc(sizeof(concurrent_buffer_t)
+        + sizeof(_Atomic size_t) * block_count + rounded);
+    atomic_init(&buffer->head, 0);
+    atomic_init(&buffer->tail, 0);
+    buffer->capacity = rounded;
+    buffer->block_count = block_count;
+    buffer->committed = (_Atomic size_t*)(buffer + 1);
+    for (size_t i = 0; i < block_count; i++)
+        atomic_init(&buffer->committed[i], 0);
+    buffer->data = (char*)(buffer->committed + block_count);
+    return buffer;
+}
+
+void destroy_concurrent_buffer(concurrent_buffer_t *buffer)
+{
+    free(buffer);
+}
+
+static __inline void get_views(const concurrent_buffer_t *buffer, uint64_t position, size_t length,
+    string_t *first, string_t *second)
+{
+    size_t offset = (size_t)(position & (buffer->capacity - 1));
+    size_t first_length = buffer->capacity - offset < length ? buffer->capacity - offset : length;
+    *first = init_string(buffer->data + offset, first_length);
+    *second = init_string(buffer->data, length - first_length);
+}
+
+/*
+    The check against the free space and the advance of the position must
+    be one atomic step, so a reservation is made by compare-and-swap
+    rather than a plain fetch-and-add; fails if the ring is full.
+    The space is counted from the start of the block being consumed,
+    since the counter of a block is reset only when it is consumed entirely
+*/
+bool reserve_in_concurrent_buffer(concurrent_buffer_t *buffer, size_t length, concurrent_reservation_t *reservation)
+{
+    uint64_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+    do
+    {
+        uint64_t tail = atomic_load_explicit(&buffer->tail, memory_order_acquire);
+        if (head + length - (tail & ~(uint64_t)(BLOCK_SIZE - 1)) > buffer->capacity)
+            return false;
+    } while (!atomic_compare_exchange_weak_explicit(&buffer->head, &head, head + length,
+        memory_order_relaxed, memory_order_relaxed));
+    reservation->position = head;
+    get_views(buffer, head, length, &reservation->first, &reservation->second);
+    return true;
+}
+
+void commit_to_concurrent_buffer(concurrent_buffer_t *buffer, const concurrent_reservation_t *reservation)
+{
+    uint64_t position = reservation->position,
+        end = position + reservation->first.length + reservation->second.length;
+    while (position < end)
+    {
+        uint64_t block_end = (position | (BLOCK_SIZE - 1)) + 1;
+        size_t length = (size_t)((block_end < end ? block_end : end) - position);
+        size_t block = (size_t)(position >> BLOCK_SHIFT) & (buffer->block_count - 1);
+        atomic_fetch_add_explicit(&buffer->committed[block], length, memory_order_release);
+        position += length;
+    }
+}
+
+bool append_to_concurrent_buffer(concurrent_buffer_t *buffer, string_t str)
+{
+    concurrent_reservation_t reservation;
+    if (!reserve_in_concurrent_buffer(buffer, str.length, &reservation))
+        return false;
+    write_to_reservation(&reservation, str);
+    commit_to_concurrent_buffer(buffer, &reservation);
+    return true;
+}
+
+/*
+    Only one thread at a time may peek and consume; the data stays
+    in place until it is consumed
+*/
+size_t peek_concurrent_buffer(concurrent_buffer_t *buffer, string_t *first, string_t *second)
+{
+    uint64_t tail = atomic_load_explicit(&buffer->tail, memory_order_relaxed),
+        position = tail;
+    for (;;)
+    {
+        uint64_t block_start = position & ~(uint64_t)(BLOCK_SIZE - 1);
+        size_t block = (size_t)(position >> BLOCK_SHIFT) & (buffer->block_count - 1);
+        size_t committed = atomic_load_explicit(&buffer->committed[block], memory_order_acquire);
+        uint64_t head = atomic_load_explicit(&buffer->head, memory_order_acquire);
+        uint64_t reserved_end = head < block_start + BLOCK_SIZE ? head : block_start + BLOCK_SIZE;
+        if (reserved_end <= position || committed != reserved_end - block_start)
+            break;
+        position = reserved_end;
+        if (reserved_end - block_start < BLOCK_SIZE)
+            break;
+    }
+    get_views(buffer, tail, (size_t)(position - tail), first, second);
+    return (size_t)(position - tail);
+}
+
+void consume_concurrent_buffer(concurrent_buffer_t *buffer, size_t length)
+{
+    uint64_t tail = atomic_load_explicit(&buffer->tail, memory_order_relaxed),
+        end = tail + length;
+    for (uint64_t block_end = (tail | (BLOCK_SIZE - 1)) + 1; block_end <= end; block_end += BLOCK_SIZE)
+    {
+        size_t block = (size_t)((block_end - 1) >> BLOCK_SHIFT) & (buffer->block_count - 1);
+        atomic_store_explicit(&buffer->committed[block], 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&buffer->tail, end, memory_order_release);
+}
+
+string_builder_t * drain_concurrent_buffer(concurrent_buffer_t *buffer, string_builder_t *obj)
+{
+    string_t first,
+        second;
+    size_t length = peek_concurrent_buffer(buffer, &first, &second);
+    obj = reserve_string_builder(obj, (obj ? obj->length : 0) + length);
+    obj = append_string(append_string(obj, first), second);
+    consume_concurrent_buffer(buffer, length);
+    return obj;
+}
@@ -0,0 +1,153 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    The implementation of the line reader
+*/
+
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
+#include "line_reader.h"
+#include "allocator.h"
+#include "reallocate.h"
+#include <limits.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static const size_t default_block_size = 1024 * 1024;
+
+static line_reader_t * instantiate_line_reader(int fd, bool owns_fd, size_t block_size)
+{
+    line_reader_t *reader = nnalloc(sizeof(line_reader_t));
+    reader->fd = fd;
+    reader->owns_fd = owns_fd;
+    reader->end_of_file = false;
+    reader->failed = false;
+    reader->capacity = block_size ? block_size : default_block_size;
+    reader->buffer = nnalloc(reader->capacity);
+    reader->begin = 0;
+    reader->end = 0;
+#if !defined(_WIN32) && defined(POSIX_FADV_SEQUENTIAL)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    return reader;
+}
+
+line_reader_t * open_line_reader(const char *file_name, size_t block_size)
+{
+#ifdef _WIN32
+    int fd = _open(file_name, _O_RDONLY | _O_BINARY | _O_SEQUENTIAL);
+#else
+    int fd = open(file_name, O_RDONLY);
+#endif
+    if (fd < 0)
+        return NULL;
+    return instantiate_line_reader(fd, true, block_size);
+}
+
+line_reader_t * create_line_reader(int fd, size_t block_size)
+{
+    return instantiate_line_reader(fd, false, block_size);
+}
+
+void destroy_line_reader(line_reader_t *reader)
+{
+    if (reader->owns_fd)
+    {
+#ifdef _WIN32
+        _close(reader->fd);
+#else
+        close(reader->fd);
+#endif
+    }
+    free(reader->buffer);
+    free(reader);
+}
+
+/*
+    The unfinished line is moved to the start of the window, which grows
+    only if a single line does not fit into it
+*/
+static void fill_window(line_reader_t *reader)
+{
+    if (reader->begin)
+    {
+        memmove(reader->buffer, reader->buffer + reader->begin, reader->end - reader->begin);
+        reader->end -= reader->begin;
+        reader->begin = 0;
+    }
+    if (reader->end == reader->capacity)
+    {
+        size_t capacity = reader->capacity * 2;
+        reader->buffer = reallocate_block(reader->buffer, reader->end, capacity);
+        reader->capacity = capacity;
+    }
+    for (;;)
+    {
+        size_t size = reader->capacity - reader->end;
+#ifdef _WIN32
+        int count = _read(reader->fd, reader->buffer + reader->end, size > INT_MAX ? INT_MAX : (unsigned int)size);
+#else
+        ssize_t count = read(reader->fd, reader->buffer + reader->end, size > SSIZE_MAX ? SSIZE_MAX : size);
+        if (count < 0 && errno == EINTR)
+            continue;
+#endif
+        if (count > 0)
+        {
+            reader->end += (size_t)count;
+        }
+        else
+        {
+            reader->end_of_file = true;
+            reader->failed = count < 0;
+        }
+        return;
+    }
+}
+
+static __inline string_t make_line(const char *data, size_t length)
+{
+    if (length && data[length - 1] == '\r')
+        length--;
+    return init_string(data, length);
+}
+
+/*
+    The returned view stays valid until the next call; the last line
+    is returned even if it is not terminated by a line feed
+*/
+bool read_next_line(line_reader_t *reader, string_t *line)
+{
+    size_t scanned = 0;
+    for (;;)
+    {
+        const char *start = reader->buffer + reader->begin;
+        size_t length = reader->end - reader->begin;
+        size_t index = scanned + index_of_char_in_string(init_string(start + scanned, length - scanned), '\n');
+        if (index < length)
+        {
+            *line = make_line(start, index);
+            reader->begin += index + 1;
+            return true;
+        }
+        if (reader->end_of_file)
+        {
+            if (!length)
+                return false;
+            *line = make_line(start, length);
+            reader->begin = reader->end;
+            return true;
+        }
+        scanned = length;
+        fill_window(reader);
+    }
+}
@@ -0,0 +1,409 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    The implementation of the multi-pattern matcher: the automaton is
+    a complete DFA stored as a dense table indexed by state and character
+    class, where only characters occurring in the patterns get their own
+    classes; code units below 256 are classified through a table,
+    the others by a binary search
+*/
+
+#include "multi_pattern.h"
+#include "allocator.h"
+#include "simd.h"
+#include "reallocate.h"
+#include <stdlib.h>
+
+#define MAX_VECTOR_START_UNITS 4
+
+struct multi_pattern_t
+{
+    uint32_t *transitions;
+    uint32_t *depths;
+    uint32_t *match_lengths;
+    uint32_t *match_patterns;
+    size_t state_count;
+    size_t class_count;
+    uint32_t byte_classes[256];
+    bool start_bytes[256];
+    unsigned char vector_start_bytes[MAX_VECTOR_START_UNITS];
+    size_t start_byte_count;
+    uint32_t *wide_units;
+    size_t wide_unit_count;
+    bool wide_starts;
+};
+
+static __inline uint32_t get_unit(const void *data, bool wide, size_t index)
+{
+    return wide ? (uint32_t)((const wchar_t*)data)[index] : (uint32_t)((const unsigned char*)data)[index];
+}
+
+static __inline const void * get_pattern_data(const void *patterns, bool wide, size_t index)
+{
+    return wide ? (const void*)((const wide_string_t*)patterns)[index].data
+        : (const void*)((const string_t*)patterns)[index].data;
+}
+
+static __inline size_t get_pattern_length(const void *patterns, bool wide, size_t index)
+{
+    return wide ? ((const wide_string_t*)patterns)[index].length : ((const string_t*)patterns)[index].length;
+}
+
+static __inline uint32_t get_class(const multi_pattern_t *matcher, uint32_t unit)
+{
+    if (unit < 256)
+        return matcher->byte_classes[unit];
+    size_t low = 0,
+        high = matcher->wide_unit_count;
+    while (low < high)
+    {
+        size_t middle = (low + high) / 2;
+        if (matcher->wide_units[middle] < unit)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    if (low < matcher->wide_unit_count && matcher->wide_units[low] == unit)
+        return (uint32_t)(matcher->class_count - matcher->wide_unit_count + low);
+    return 0;
+}
+
+static int compare_units(const void *first, const void *second)
+{
+    uint32_t a = *(const uint32_t*)first,
+        b = *(const uint32_t*)second;
+    return a < b ? -1 : (a > b ? 1 : 0);
+}
+
+static void assign_classes(multi_pattern_t *matcher, const void *patterns, bool wide, size_t count, size_t total)
+{
+    bool used[256] = { false };
+    matcher->wide_units = nnalloc(sizeof(uint32_t) * (total + 1));
+    size_t wide_count = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const void *data = get_pattern_data(patterns, wide, i);
+        size_t length = get_pattern_length(patterns, wide, i);
+        for (size_t j = 0; j < length; j++)
+        {
+            uint32_t unit = get_unit(data, wide, j);
+            if (unit < 256)
+                used[unit] = true;
+            else
+                matcher->wide_units[wide_count++] = unit;
+        }
+    }
+    qsort(matcher->wide_units, wide_count, sizeof(uint32_t), compare_units);
+    size_t unique = 0;
+    for (size_t i = 0; i < wide_count; i++)
+    {
+        if (!unique || matcher->wide_units[unique - 1] != matcher->wide_units[i])
+            matcher->wide_units[unique++] = matcher->wide_units[i];
+    }
+    matcher->wide_unit_count = unique;
+    uint32_t next_class = 1;
+    for (int unit = 0; unit < 256; unit++)
+        matcher->byte_classes[unit] = used[unit] ? next_class++ : 0;
+    matcher->class_count = next_class + unique;
+}
+
+/*
+    The trie is built first, then a breadth-first pass sets the failure
+    links and replaces every missing transition by the transition of the
+    failure state, whose row is already complete at that moment
+*/
+static multi_pattern_t * build_multi_pattern(const void *patterns, bool wide, size_t count)
+{
+    size_t total = 1;
+    for (size_t i = 0; i < count; i++)
+        total += get_pattern_length(patterns, wide, i);
+    multi_pattern_t *matcher = nnalloc(sizeof(multi_pattern_t));
+    assign_classes(matcher, patterns, wide, count, total);
+    size_t classes = matcher->class_count;
+    matcher->transitions = nnalloc(sizeof(uint32_t) * total * classes);
+    memset(matcher->transitions, 0, sizeof(uint32_t) * total * classes);
+    matcher->depths = nnalloc(sizeof(uint32_t) * total);
+    matcher->match_lengths = nnalloc(sizeof(uint32_t) * total);
+    matcher->match_patterns = nnalloc(sizeof(uint32_t) * total);
+    matcher->depths[0] = 0;
+    matcher->match_lengths[0] = 0;
+    matcher->match_patterns[0] = 0;
+    size_t states = 1;
+    for (size_t i = 0; i < count; i++)
+    {
+        const void *data = get_pattern_data(patterns, wide, i);
+        size_t length = get_pattern_length(patterns, wide, i);
+        if (!length)
+            continue;
+        uint32_t state = 0;
+        for (size_t j = 0; j < length; j++)
+        {
+            uint32_t *next = &matcher->transitions[state * classes + get_class(matcher, get_unit(data, wide, j))];
+            if (!*next)
+            {
+                matcher->depths[states] = (uint32_t)(j + 1);
+                matcher->match_lengths[states] = 0;
+                matcher->match_patterns[states] = 0;
+                *next = (uint32_t)states++;
+            }
+            state = *next;
+        }
+        if (matcher->match_lengths[state] != length)
+        {
+            matcher->match_lengths[state] = (uint32_t)length;
+            matcher->match_patterns[state] = (uint32_t)i;
+        }
+    }
+    uint32_t *fail = nnalloc(sizeof(uint32_t) * states);
+    uint32_t *queue = nnalloc(sizeof(uint32_t) * states);
+    size_t head = 0,
+        tail = 0;
+    for (size_t c = 0; c < classes; c++)
+    {
+        uint32_t child = matcher->transitions[c];
+        if (child)
+        {
+            fail[child] = 0;
+            queue[tail++] = child;
+        }
+    }
+    while (head < tail)
+    {
+        uint32_t state = queue[head++];
+        uint32_t *row = &matcher->transitions[state * classes];
+        const uint32_t *fail_row = &matcher->transitions[fail[state] * classes];
+        for (size_t c = 0; c < classes; c++)
+        {
+            uint32_t child = row[c];
+            if (child)
+            {
+                fail[child] = fail_row[c];
+                if (!matcher->match_lengths[child])
+                {
+                    matcher->match_lengths[child] = matcher->match_lengths[fail[child]];
+                    matcher->match_patterns[child] = matcher->match_patterns[fail[child]];
+                }
+                queue[tail++] = child;
+            }
+            else
+            {
+                row[c] = fail_row[c];
+            }
+        }
+    }
+    free(queue);
+    free(fail);
+    matcher->state_count = states;
+    matcher->start_byte_count = 0;
+    for (int unit = 0; unit < 256; unit++)
+    {
+        matcher->start_bytes[unit] = matcher->transitions[matcher->byte_classes[unit]] != 0;
+        if (matcher->start_bytes[unit])
+        {
+            if (matcher->start_byte_count < MAX_VECTOR_START_UNITS)
+                matcher->vector_start_bytes[matcher->start_byte_count] = (unsigned char)unit;
+            matcher->start_byte_count++;
+        }
+    }
+    matcher->wide_starts = false;
+    for (size_t c = classes - matcher->wide_unit_count; c < classes; c++)
+    {
+        if (matcher->transitions[c])
+            matcher->wide_starts = true;
+    }
+    return matcher;
+}
+
+multi_pattern_t * compile_multi_pattern(const string_t *patterns, size_t count)
+{
+    return build_multi_pattern(patterns, false, count);
+}
+
+multi_pattern_t * compile_wide_multi_pattern(const wide_string_t *patterns, size_t count)
+{
+    return build_multi_pattern(patterns, true, count);
+}
+
+void destroy_multi_pattern(multi_pattern_t *matcher)
+{
+    free(matcher->transitions);
+    free(matcher->depths);
+    free(matcher->match_lengths);
+    free(matcher->match_patterns);
+    free(matcher->wide_units);
+    free(matcher);
+}
+
+/*
+    From the initial state, the text is skipped up to the next character
+    that can start a pattern; for a few distinct starting bytes
+    the narrow text is scanned by vector comparisons
+*/
+static size_t skip_to_start(const multi_pattern_t *matcher, const void *data, bool wide, size_t index, size_t length)
+{
+    if (wide)
+    {
+        for (; index < length; index++)
+        {
+            uint32_t unit = get_unit(data, true, index);
+            if (unit < 256 ? matcher->start_bytes[unit]
+                    : matcher->wide_starts && matcher->transitions[get_class(matcher, unit)] != 0)
+                return index;
+        }
+        return length;
+    }
+    const unsigned char *bytes = (const unsigned char*)data;
+#ifdef STRINGS_SSE2
+    if (matcher->start_byte_count && matcher->start_byte_count <= MAX_VECTOR_START_UNITS)
+    {
+        __m128i patterns[MAX_VECTOR_START_UNITS];
+        for (size_t k = 0; k < matcher->start_byte_count; k++)
+            patterns[k] = _mm_set1_epi8((char)matcher->vector_start_bytes[k]);
+        for (; index + 16 <= length; index += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(bytes + index));
+            __m128i hits = _mm_cmpeq_epi8(v, patterns[0]);
+            for (size_t k = 1; k < matcher->start_byte_count; k++)
+                hits = _mm_or_si128(hits, _mm_cmpeq_epi8(v, patterns[k]));
+            unsigned int mask = (unsigned int)_mm_movemask_epi8(hits);
+            if (mask)
+                return index + count_trailing_zeros(mask);
+        }
+    }
+#endif
+    while (index < length && !matcher->start_bytes[bytes[index]])
+        index++;
+    return index;
+}
+
+/*
+    The scan goes on after the first match while the deepest live prefix
+    still starts at or before the best match found so far, since only such
+    a prefix can grow into a match further to the left or a longer one
+*/
+static __inline bool find_next_match(const multi_pattern_t *matcher, const void *data, bool wide, size_t length,
+    size_t start, pattern_match_t *match)
+{
+    const uint32_t *transitions = matcher->transitions;
+    size_t classes = matcher->class_count;
+    size_t best_start = SIZE_MAX,
+        best_end = 0,
+        best_pattern = 0;
+    uint32_t state = 0;
+    size_t i = start;
+    while (i < length)
+    {
+        if (!state)
+        {
+            if (best_start != SIZE_MAX)
+                break;
+            i = skip_to_start(matcher, data, wide, i, length);
+            if (i == length)
+                break;
+        }
+        state = transitions[state * classes + get_class(matcher, get_unit(data, wide, i))];
+        i++;
+        if (best_start != SIZE_MAX && i - matcher->depths[state] > best_start)
+            break;
+        size_t matched = matcher->match_lengths[state];
+        if (matched)
+        {
+            size_t first = i - matched;
+            if (best_start == SIZE_MAX || first < best_start || (first == best_start && i > best_end))
+            {
+                best_start = first;
+                best_end = i;
+                best_pattern = matcher->match_patterns[state];
+            }
+        }
+    }
+    if (best_start == SIZE_MAX)
+        return false;
+    match->index = best_start;
+    match->length = best_end - best_start;
+    match->pattern = best_pattern;
+    return true;
+}
+
+bool find_next_pattern(const multi_pattern_t *matcher, string_t str, size_t start, pattern_match_t *match)
+{
+    return find_next_match(matcher, str.data, false, str.length, start, match);
+}
+
+bool find_next_wide_pattern(const multi_pattern_t *matcher, wide_string_t wstr, size_t start, pattern_match_t *match)
+{
+    return find_next_match(matcher, wstr.data, true, wstr.length, start, match);
+}
+
+static pattern_matches_list_t * find_all_matches(const multi_pattern_t *matcher, const void *data, bool wide,
+    size_t length)
+{
+    size_t capacity = 16;
+    pattern_matches_list_t *list = nnalloc(sizeof(pattern_matches_list_t) + sizeof(pattern_match_t) * capacity);
+    list->size = 0;
+    pattern_match_t match;
+    size_t start = 0;
+    while (find_next_match(matcher, data, wide, length, start, &match))
+    {
+        if (list->size == capacity)
+        {
+            capacity *= 2;
+            list = reallocate_block(list, sizeof(pattern_matches_list_t) + sizeof(pattern_match_t) * list->size,
+                sizeof(pattern_matches_list_t) + sizeof(pattern_match_t) * capacity);
+        }
+        ((pattern_match_t*)(list + 1))[list->size++] = match;
+        start = match.index + match.length;
+    }
+    list->items = (pattern_match_t*)(list + 1);
+    return list;
+}
+
+pattern_matches_list_t * find_all_patterns(const multi_pattern_t *matcher, string_t str)
+{
+    return find_all_matches(matcher, str.data, false, str.length);
+}
+
+pattern_matches_list_t * find_all_wide_patterns(const multi_pattern_t *matcher, wide_string_t wstr)
+{
+    return find_all_matches(matcher, wstr.data, true, wstr.length);
+}
+
+string_builder_t * replace_patterns(string_builder_t *obj, const multi_pattern_t *matcher, string_t str,
+    const string_t *replacements)
+{
+    pattern_matches_list_t *matches = find_all_patterns(matcher, str);
+    size_t capacity = str.length;
+    for (size_t i = 0; i < matches->size; i++)
+        capacity += replacements[matches->items[i].pattern].length - matches->items[i].length;
+    obj = reserve_string_builder(obj, (obj ? obj->length : 0) + capacity);
+    size_t start = 0;
+    for (size_t i = 0; i < matches->size; i++)
+    {
+        const pattern_match_t *match = &matches->items[i];
+        obj = append_string(obj, init_string(str.data + start, match->index - start));
+        obj = append_string(obj, replacements[match->pattern]);
+        start = match->index + match->length;
+    }
+    free(matches);
+    return append_string(obj, init_string(str.data + start, str.length - start));
+}
+
+wide_string_builder_t * replace_wide_patterns(wide_string_builder_t *obj, const multi_pattern_t *matcher,
+    wide_string_t wstr, const wide_string_t *replacements)
+{
+    pattern_matches_list_t *matches = find_all_wide_patterns(matcher, wstr);
+    size_t capacity = wstr.length;
+    for (size_t i = 0; i < matches->size; i++)
+        capacity += replacements[matches->items[i].pattern].length - matches->items[i].length;
+    obj = reserve_wide_string_builder(obj, (obj ? obj->length : 0) + capacity);
+    size_t start = 0;
+    for (size_t i = 0; i < matches->size; i++)
+    {
+        const pattern_match_t *match = &matches->items[i];
+        obj = append_wide_string(obj, init_wide_string(wstr.data + start, match->index - start));
+        obj = append_wide_string(obj, replacements[match->pattern]);
+        start = match->index + match->length;
+    }
+    free(matches);
+    return append_wide_string(obj, init_wide_string(wstr.data + start, wstr.length - start));
+}
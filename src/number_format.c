@@ -0,0 +1,349 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Conversion of numbers to text: integers use a table of digit pairs,
+    doubles use the Grisu2 algorithm by Florian Loitsch which yields
+    the shortest representation that reads back to the same value
+*/
+
+#include "number_format.h"
+#include <string.h>
+
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+size_t format_uint64(char *buffer, uint64_t value)
+{
+    char tmp[MAX_INTEGER_TEXT_LENGTH];
+    char *end = tmp + sizeof(tmp);
+    char *ptr = end;
+    while (value >= 100)
+    {
+        unsigned int pair = (unsigned int)(value % 100);
+        value /= 100;
+        ptr -= 2;
+        memcpy(ptr, digit_pairs + pair * 2, 2);
+    }
+    if (value >= 10)
+    {
+        ptr -= 2;
+        memcpy(ptr, digit_pairs + value * 2, 2);
+    }
+    else
+    {
+        *--ptr = (char)('0' + value);
+    }
+    size_t length = (size_t)(end - ptr);
+    memcpy(buffer, ptr, length);
+    return length;
+}
+
+size_t format_int64(char *buffer, int64_t value)
+{
+    if (value < 0)
+    {
+        buffer[0] = '-';
+        return 1 + format_uint64(buffer + 1, (uint64_t)0 - (uint64_t)value);
+    }
+    return format_uint64(buffer, (uint64_t)value);
+}
+
+typedef struct
+{
+    uint64_t f;
+    int e;
+} diy_fp_t;
+
+static const uint64_t cached_powers_f[] =
+{
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+    0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+    0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+    0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+    0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+    0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+    0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+    0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+    0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+    0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+    0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+    0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+    0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+    0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+    0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+    0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+    0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+    0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+    0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+    0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+    0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+    0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL
+};
+
+static const short cached_powers_e[] =
+{
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066
+};
+
+static const uint64_t powers_of_ten[] =
+{
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+    100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+    10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+static const uint64_t hidden_bit = 0x0010000000000000ULL;
+static const uint64_t significand_mask = 0x000FFFFFFFFFFFFFULL;
+static const uint64_t exponent_mask = 0x7FF0000000000000ULL;
+
+static diy_fp_t multiply(diy_fp_t x, diy_fp_t y)
+{
+    const uint64_t mask_32 = 0xFFFFFFFFULL;
+    uint64_t a = x.f >> 32, b = x.f & mask_32, c = y.f >> 32, d = y.f & mask_32;
+    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    uint64_t tmp = (bd >> 32) + (ad & mask_32) + (bc & mask_32) + (1ULL << 31);
+    diy_fp_t result = { ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), x.e + y.e + 64 };
+    return result;
+}
+
+static diy_fp_t normalize(diy_fp_t x)
+{
+    while (!(x.f & 0x8000000000000000ULL))
+    {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+static void get_normalized_boundaries(diy_fp_t v, diy_fp_t *minus, diy_fp_t *plus)
+{
+    diy_fp_t pl = { (v.f << 1) + 1, v.e - 1 };
+    while (!(pl.f & (hidden_bit << 1)))
+    {
+        pl.f <<= 1;
+        pl.e--;
+    }
+    pl.f <<= 64 - 52 - 2;
+    pl.e -= 64 - 52 - 2;
+    diy_fp_t mi;
+    if (v.f == hidden_bit)
+    {
+        mi.f = (v.f << 2) - 1;
+        mi.e = v.e - 2;
+    }
+    else
+    {
+        mi.f = (v.f << 1) - 1;
+        mi.e = v.e - 1;
+    }
+    mi.f <<= mi.e - pl.e;
+    mi.e = pl.e;
+    *plus = pl;
+    *minus = mi;
+}
+
+static diy_fp_t get_cached_power(int e, int *k)
+{
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int ik = (int)dk;
+    if (dk - ik > 0.0)
+        ik++;
+    unsigned int index = (unsigned int)((ik >> 3) + 1);
+    *k = -(-348 + (int)(index << 3));
+    diy_fp_t result = { cached_powers_f[index], cached_powers_e[index] };
+    return result;
+}
+
+static void round_last_digit(char *buffer, int length, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w)
+{
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+        (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w))
+    {
+        buffer[length - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+static int count_decimal_digits(uint32_t n)
+{
+    int count = 1;
+    while (count < 10 && n >= powers_of_ten[count])
+        count++;
+    return count;
+}
+
+static int generate_digits(diy_fp_t w, diy_fp_t mp, uint64_t delta, char *buffer, int *k)
+{
+    diy_fp_t one = { 1ULL << -mp.e, mp.e };
+    uint64_t wp_w = mp.f - w.f;
+    uint32_t p1 = (uint32_t)(mp.f >> -one.e);
+    uint64_t p2 = mp.f & (one.f - 1);
+    int kappa = count_decimal_digits(p1);
+    int length = 0;
+    while (kappa > 0)
+    {
+        uint32_t divisor = (uint32_t)powers_of_ten[kappa - 1];
+        uint32_t d = p1 / divisor;
+        p1 %= divisor;
+        if (d || length)
+            buffer[length++] = (char)('0' + d);
+        kappa--;
+        uint64_t tmp = ((uint64_t)p1 << -one.e) + p2;
+        if (tmp <= delta)
+        {
+            *k += kappa;
+            round_last_digit(buffer, length, delta, tmp, powers_of_ten[kappa] << -one.e, wp_w);
+            return length;
+        }
+    }
+    for (;;)
+    {
+        p2 *= 10;
+        delta *= 10;
+        char d = (char)(p2 >> -one.e);
+        if (d || length)
+            buffer[length++] = (char)('0' + d);
+        p2 &= one.f - 1;
+        kappa--;
+        if (p2 < delta)
+        {
+            *k += kappa;
+            int index = -kappa;
+            round_last_digit(buffer, length, delta, p2, one.f, wp_w * (index < 20 ? powers_of_ten[index] : 0));
+            return length;
+        }
+    }
+}
+
+static int grisu2(double value, char *buffer, int *k)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    int biased_e = (int)((bits & exponent_mask) >> 52);
+    diy_fp_t v;
+    v.f = bits & significand_mask;
+    if (biased_e)
+    {
+        v.f += hidden_bit;
+        v.e = biased_e - 1075;
+    }
+    else
+    {
+        v.e = -1074;
+    }
+    diy_fp_t w_m, w_p;
+    get_normalized_boundaries(v, &w_m, &w_p);
+    diy_fp_t c_mk = get_cached_power(w_p.e, k);
+    diy_fp_t w = multiply(normalize(v), c_mk);
+    diy_fp_t wp = multiply(w_p, c_mk);
+    diy_fp_t wm = multiply(w_m, c_mk);
+    wm.f++;
+    wp.f--;
+    return generate_digits(w, wp, wp.f - wm.f, buffer, k);
+}
+
+static size_t write_exponent(char *buffer, int k)
+{
+    size_t length = 0;
+    buffer[length++] = 'e';
+    if (k < 0)
+    {
+        buffer[length++] = '-';
+        k = -k;
+    }
+    else
+    {
+        buffer[length++] = '+';
+    }
+    return length + format_uint64(buffer + length, (uint64_t)k);
+}
+
+static size_t prettify(char *buffer, int length, int k)
+{
+    int kk = length + k;
+    if (k >= 0 && kk <= 21)
+    {
+        for (int i = length; i < kk; i++)
+            buffer[i] = '0';
+        return (size_t)kk;
+    }
+    if (kk > 0 && kk <= 21)
+    {
+        memmove(buffer + kk + 1, buffer + kk, (size_t)(length - kk));
+        buffer[kk] = '.';
+        return (size_t)length + 1;
+    }
+    if (kk > -6 && kk <= 0)
+    {
+        int offset = 2 - kk;
+        memmove(buffer + offset, buffer, (size_t)length);
+        buffer[0] = '0';
+        buffer[1] = '.';
+        for (int i = 2; i < offset; i++)
+            buffer[i] = '0';
+        return (size_t)(length + offset);
+    }
+    if (length == 1)
+        return 1 + write_exponent(buffer + 1, kk - 1);
+    memmove(buffer + 2, buffer + 1, (size_t)(length - 1));
+    buffer[1] = '.';
+    return (size_t)length + 1 + write_exponent(buffer + length + 1, kk - 1);
+}
+
+size_t format_double_shortest(char *buffer, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    size_t sign = 0;
+    if (bits >> 63)
+    {
+        buffer[0] = '-';
+        sign = 1;
+        bits &= ~(1ULL << 63);
+        memcpy(&value, &bits, sizeof(bits));
+    }
+    if ((bits & exponent_mask) == exponent_mask)
+    {
+        if (bits & significand_mask)
+        {
+            memcpy(buffer + sign, "nan", 3);
+            return sign + 3;
+        }
+        memcpy(buffer + sign, "inf", 3);
+        return sign + 3;
+    }
+    if (bits == 0)
+    {
+        buffer[sign] = '0';
+        return sign + 1;
+    }
+    int k = 0;
+    int length = grisu2(value, buffer + sign, &k);
+    return sign + prettify(buffer + sign, length, k);
+}
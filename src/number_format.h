@@ -0,0 +1,17 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Conversion of numbers to text without the 'printf' family
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MAX_INTEGER_TEXT_LENGTH 20
+#define MAX_DOUBLE_TEXT_LENGTH 32
+
+size_t format_uint64(char *buffer, uint64_t value);
+size_t format_int64(char *buffer, int64_t value);
+size_t format_double_shortest(char *buffer, double value);
@@ -0,0 +1,398 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Parsing of numbers from length-bounded strings: digits are converted
+    eight at a time with SWAR arithmetic, doubles use the Eisel-Lemire
+    algorithm and fall back to 'strtod' only when its result is ambiguous
+*/
+
+#include "strings.h"
+#include "allocator.h"
+#include "simd.h"
+#include "number_format.h"
+#include "pow5_table.h"
+#include <stdlib.h>
+#include <float.h>
+#include <math.h>
+
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define SWAR_DIGITS
+#endif
+
+static __inline bool is_digit(char ch)
+{
+    return ch >= '0' && ch <= '9';
+}
+
+#ifdef SWAR_DIGITS
+static __inline uint64_t read_eight_bytes(const char *data)
+{
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static __inline bool are_eight_digits(uint64_t value)
+{
+    return (((value & 0xF0F0F0F0F0F0F0F0ULL)
+        | (((value + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) == 0x3333333333333333ULL);
+}
+
+/*
+    Adjacent digits are combined into pairs, the pairs into quads,
+    and the quads into the result, each step by one multiplication
+*/
+static __inline uint32_t parse_eight_digits(uint64_t value)
+{
+    const uint64_t mask = 0x000000FF000000FFULL;
+    const uint64_t mul1 = 0x000F424000000064ULL;
+    const uint64_t mul2 = 0x0000271000000001ULL;
+    value -= 0x3030303030303030ULL;
+    value = (value * 10) + (value >> 8);
+    return (uint32_t)((((value & mask) * mul1) + (((value >> 16) & mask) * mul2)) >> 32);
+}
+#endif
+
+/*
+    Accumulates digits modulo 2^64 and returns the position
+    of the first character that is not a digit
+*/
+static __inline const char * accumulate_digits(const char *p, const char *end, uint64_t *value)
+{
+    uint64_t result = *value;
+#ifdef SWAR_DIGITS
+    while (end - p >= 8)
+    {
+        uint64_t block = read_eight_bytes(p);
+        if (!are_eight_digits(block))
+            break;
+        result = result * 100000000 + parse_eight_digits(block);
+        p += 8;
+    }
+#endif
+    while (p < end && is_digit(*p))
+    {
+        result = result * 10 + (uint64_t)(*p - '0');
+        p++;
+    }
+    *value = result;
+    return p;
+}
+
+static size_t parse_magnitude(const char *data, size_t length, uint64_t *value)
+{
+    const char *p = data,
+        *end = data + length;
+    while (p < end && *p == '0')
+        p++;
+    const char *significant = p;
+    uint64_t result = 0;
+    p = accumulate_digits(p, end, &result);
+    size_t count = (size_t)(p - significant);
+    if (p == data)
+        return 0;
+    if (count > 20 || (count == 20 && (significant[0] > '1' || result < 10000000000000000000ULL)))
+        return 0;
+    *value = result;
+    return (size_t)(p - data);
+}
+
+size_t parse_uint64(string_t str, uint64_t *value)
+{
+    size_t sign = str.length && str.data[0] == '+' ? 1 : 0;
+    size_t count = parse_magnitude(str.data + sign, str.length - sign, value);
+    return count ? sign + count : 0;
+}
+
+size_t parse_int64(string_t str, int64_t *value)
+{
+    bool negative = str.length && str.data[0] == '-';
+    size_t sign = str.length && (str.data[0] == '-' || str.data[0] == '+') ? 1 : 0;
+    uint64_t magnitude;
+    size_t count = parse_magnitude(str.data + sign, str.length - sign, &magnitude);
+    if (!count || magnitude > (negative ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX))
+        return 0;
+    *value = negative ? (int64_t)(0 - magnitude) : (int64_t)magnitude;
+    return sign + count;
+}
+
+typedef struct
+{
+    uint64_t mantissa;
+    int exponent;
+    bool valid;
+} binary_float_t;
+
+static const int mantissa_bits = 52;
+static const int minimum_exponent = -1023;
+static const int infinite_exponent = 0x7FF;
+
+/*
+    Computes the binary64 value of w * 10^q, w != 0, from a 128-bit
+    approximation of w * 5^q; the result is marked invalid when the
+    truncated bits of the product may change the rounding
+*/
+static binary_float_t compute_float(uint64_t w, int64_t q)
+{
+    binary_float_t answer = { 0, 0, true };
+    if (q < SMALLEST_POWER_OF_FIVE)
+        return answer;
+    if (q > LARGEST_POWER_OF_FIVE)
+    {
+        answer.exponent = infinite_exponent;
+        return answer;
+    }
+    int leading_zeros = 63 - (int)highest_bit_index_64(w);
+    w <<= leading_zeros;
+    size_t index = (size_t)(q - SMALLEST_POWER_OF_FIVE) * 2;
+    uint64_t high;
+    uint64_t low = multiply_64x64(w, powers_of_five_128[index], &high);
+    const uint64_t precision_mask = 0xFFFFFFFFFFFFFFFFULL >> (mantissa_bits + 3);
+    if ((high & precision_mask) == precision_mask)
+    {
+        uint64_t second_high;
+        multiply_64x64(w, powers_of_five_128[index + 1], &second_high);
+        low += second_high;
+        if (second_high > low)
+            high++;
+        if (low == 0xFFFFFFFFFFFFFFFFULL && (q < -27 || q > 55))
+        {
+            answer.valid = false;
+            return answer;
+        }
+    }
+    int upper_bit = (int)(high >> 63);
+    int shift = upper_bit + 64 - mantissa_bits - 3;
+    answer.mantissa = high >> shift;
+    answer.exponent = (int)((((152170 + 65536) * q) >> 16) + 63) + upper_bit - leading_zeros - minimum_exponent;
+    if (answer.exponent <= 0)
+    {
+        if (-answer.exponent + 1 >= 64)
+        {
+            answer.mantissa = 0;
+            answer.exponent = 0;
+            return answer;
+        }
+        answer.mantissa >>= -answer.exponent + 1;
+        answer.mantissa += answer.mantissa & 1;
+        answer.mantissa >>= 1;
+        answer.exponent = answer.mantissa < (1ULL << mantissa_bits) ? 0 : 1;
+        return answer;
+    }
+    if (low <= 1 && q >= -4 && q <= 23 && (answer.mantissa & 3) == 1
+        && (answer.mantissa << shift) == high)
+    {
+        answer.mantissa &= ~1ULL;
+    }
+    answer.mantissa += answer.mantissa & 1;
+    answer.mantissa >>= 1;
+    if (answer.mantissa >= (2ULL << mantissa_bits))
+    {
+        answer.mantissa = 1ULL << mantissa_bits;
+        answer.exponent++;
+    }
+    answer.mantissa &= ~(1ULL << mantissa_bits);
+    if (answer.exponent >= infinite_exponent)
+    {
+        answer.exponent = infinite_exponent;
+        answer.mantissa = 0;
+    }
+    return answer;
+}
+
+static __inline double make_double(binary_float_t value, bool negative)
+{
+    uint64_t bits = value.mantissa | ((uint64_t)value.exponent << mantissa_bits) | ((uint64_t)negative << 63);
+    double result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+static const double exact_powers_of_ten[] =
+{
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static __inline char to_lower_ascii(char ch)
+{
+    return ch >= 'A' && ch <= 'Z' ? ch + ('a' - 'A') : ch;
+}
+
+static size_t match_word_ignore_case(const char *p, const char *end, const char *word)
+{
+    size_t i = 0;
+    for (; word[i]; i++)
+    {
+        if (p + i == end || to_lower_ascii(p[i]) != word[i])
+            return 0;
+    }
+    return i;
+}
+
+typedef struct
+{
+    const char *integer;
+    const char *integer_end;
+    const char *fraction;
+    const char *fraction_end;
+    int64_t exponent;
+} decimal_text_t;
+
+/*
+    The slow path: the digits are passed to 'strtod' without the decimal
+    point, so the result does not depend on the current locale
+*/
+static double parse_with_strtod(const decimal_text_t *text)
+{
+    size_t integer_length = (size_t)(text->integer_end - text->integer),
+        fraction_length = (size_t)(text->fraction_end - text->fraction);
+    char local[128];
+    size_t size = integer_length + fraction_length + MAX_INTEGER_TEXT_LENGTH + 3;
+    char *buffer = size <= sizeof(local) ? local : nnalloc(size);
+    memcpy(buffer, text->integer, integer_length);
+    memcpy(buffer + integer_length, text->fraction, fraction_length);
+    size_t length = integer_length + fraction_length;
+    buffer[length++] = 'e';
+    length += format_int64(buffer + length, text->exponent - (int64_t)fraction_length);
+    buffer[length] = '\0';
+    double result = strtod(buffer, NULL);
+    if (buffer != local)
+        free(buffer);
+    return result;
+}
+
+/*
+    Takes at most 19 significant digits, enough for the value to fit
+    into 64 bits, and returns the decimal exponent of the last one taken
+*/
+static int64_t take_significant_digits(const decimal_text_t *text, uint64_t *w)
+{
+    uint64_t result = 0;
+    const char *p = text->integer;
+    while (p < text->integer_end && result < 1000000000000000000ULL)
+        result = result * 10 + (uint64_t)(*p++ - '0');
+    int64_t exponent = (int64_t)(text->integer_end - p);
+    if (p == text->integer_end)
+    {
+        p = text->fraction;
+        if (!result)
+        {
+            while (p < text->fraction_end && *p == '0')
+                p++;
+        }
+        while (p < text->fraction_end && result < 1000000000000000000ULL)
+            result = result * 10 + (uint64_t)(*p++ - '0');
+        exponent = text->fraction - p;
+    }
+    *w = result;
+    return exponent + text->exponent;
+}
+
+size_t parse_double(string_t str, double *value)
+{
+    const char *p = str.data,
+        *end = str.data + str.length;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+    if (p < end && !is_digit(*p) && *p != '.')
+    {
+        size_t count = match_word_ignore_case(p, end, "inf");
+        if (count)
+        {
+            count += match_word_ignore_case(p + count, end, "inity");
+            *value = negative ? -HUGE_VAL : HUGE_VAL;
+            return (size_t)(p - str.data) + count;
+        }
+        count = match_word_ignore_case(p, end, "nan");
+        if (count)
+        {
+            *value = negative ? -NAN : NAN;
+            return (size_t)(p - str.data) + count;
+        }
+        return 0;
+    }
+    decimal_text_t text;
+    uint64_t w = 0;
+    text.integer = p;
+    p = accumulate_digits(p, end, &w);
+    text.integer_end = p;
+    text.fraction = text.fraction_end = p;
+    if (p < end && *p == '.')
+    {
+        text.fraction = ++p;
+        p = accumulate_digits(p, end, &w);
+        text.fraction_end = p;
+    }
+    size_t digit_count = (size_t)(text.integer_end - text.integer) + (size_t)(text.fraction_end - text.fraction);
+    if (!digit_count)
+        return 0;
+    text.exponent = 0;
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char *e = p + 1;
+        bool negative_exponent = false;
+        if (e < end && (*e == '-' || *e == '+'))
+            negative_exponent = *e++ == '-';
+        if (e < end && is_digit(*e))
+        {
+            int64_t exponent = 0;
+            for (; e < end && is_digit(*e); e++)
+            {
+                if (exponent < 0x10000000)
+                    exponent = exponent * 10 + (*e - '0');
+            }
+            text.exponent = negative_exponent ? -exponent : exponent;
+            p = e;
+        }
+    }
+    size_t consumed = (size_t)(p - str.data);
+    const char *significant = text.integer;
+    while (significant < text.integer_end && *significant == '0')
+        significant++;
+    if (significant == text.integer_end)
+    {
+        significant = text.fraction;
+        while (significant < text.fraction_end && *significant == '0')
+            significant++;
+        digit_count = (size_t)(text.fraction_end - significant);
+    }
+    else
+    {
+        digit_count -= (size_t)(significant - text.integer);
+    }
+    int64_t q = text.exponent - (text.fraction_end - text.fraction);
+    bool truncated = false;
+    if (digit_count > 19)
+    {
+        q = take_significant_digits(&text, &w);
+        truncated = true;
+    }
+    if (!w)
+    {
+        *value = negative ? -0.0 : 0.0;
+        return consumed;
+    }
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+    if (!truncated && q >= -22 && q <= 22 && w <= (1ULL << 53))
+    {
+        double result = (double)w;
+        result = q < 0 ? result / exact_powers_of_ten[-q] : result * exact_powers_of_ten[q];
+        *value = negative ? -result : result;
+        return consumed;
+    }
+#endif
+    binary_float_t result = compute_float(w, q);
+    if (truncated && result.valid)
+    {
+        binary_float_t next = compute_float(w + 1, q);
+        if (!next.valid || next.mantissa != result.mantissa || next.exponent != result.exponent)
+            result.valid = false;
+    }
+    if (result.valid)
+        *value = make_double(result, negative);
+    else
+        *value = negative ? -parse_with_strtod(&text) : parse_with_strtod(&text);
+    return consumed;
+}
@@ -0,0 +1,150 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    The implementation of multi-threaded variants of the string functions:
+    the buffer is cut into chunks processed by a work-stealing executor;
+    thread_count 0 means one thread per hardware thread
+*/
+
+#include "parallel_strings.h"
+#include "thread_pool.h"
+#include "allocator.h"
+
+static const size_t minimal_chunk_size = 64 * 1024;
+static const size_t chunks_per_thread = 8;
+
+typedef struct
+{
+    string_t str;
+    char separator;
+    size_t chunk_size;
+    size_t chunk_count;
+    size_t *counts;
+    strings_list_t *list;
+} chunked_task_t;
+
+static size_t get_chunk_count(size_t length, size_t *thread_count)
+{
+    if (!*thread_count)
+        *thread_count = get_hardware_thread_count();
+    size_t count = *thread_count * chunks_per_thread;
+    if (count > length / minimal_chunk_size)
+        count = length / minimal_chunk_size;
+    return count;
+}
+
+static size_t init_chunked_task(chunked_task_t *context, string_t str, char separator, size_t chunk_count)
+{
+    context->str = str;
+    context->separator = separator;
+    context->chunk_size = (str.length + chunk_count - 1) / chunk_count;
+    context->chunk_count = (str.length + context->chunk_size - 1) / context->chunk_size;
+    context->counts = NULL;
+    context->list = NULL;
+    return context->chunk_count;
+}
+
+static __inline string_t get_chunk(const chunked_task_t *context, size_t index)
+{
+    size_t begin = index * context->chunk_size,
+        end = begin + context->chunk_size;
+    if (end > context->str.length)
+        end = context->str.length;
+    return init_string(context->str.data + begin, end - begin);
+}
+
+static void count_chunk(void *arg, size_t index)
+{
+    chunked_task_t *context = (chunked_task_t*)arg;
+    context->counts[index] = count_of_char_in_string(get_chunk(context, index), context->separator);
+}
+
+size_t parallel_count_char(string_t str, char ch, size_t thread_count)
+{
+    size_t chunk_count = get_chunk_count(str.length, &thread_count);
+    if (chunk_count < 2 || thread_count < 2)
+        return count_of_char_in_string(str, ch);
+    chunked_task_t context;
+    chunk_count = init_chunked_task(&context, str, ch, chunk_count);
+    context.counts = nnalloc(sizeof(size_t) * chunk_count);
+    run_parallel_tasks(chunk_count, thread_count, count_chunk, &context);
+    size_t total = 0;
+    for (size_t i = 0; i < chunk_count; i++)
+        total += context.counts[i];
+    free(context.counts);
+    return total;
+}
+
+/*
+    Each chunk emits the tokens that start inside it; the index of its first
+    token is known from the prefix sum of the separator counts, so the chunks
+    fill disjoint ranges of the list; the last token of a chunk may end
+    in one of the following chunks
+*/
+static void split_chunk(void *arg, size_t index)
+{
+    chunked_task_t *context = (chunked_task_t*)arg;
+    string_t str = context->str;
+    string_t chunk = get_chunk(context, index);
+    size_t chunk_end = (size_t)(chunk.data - str.data) + chunk.length;
+    size_t position = (size_t)(chunk.data - str.data);
+    size_t token = context->counts[index];
+    size_t start = 0;
+    bool open = index == 0;
+    for (;;)
+    {
+        size_t found = index_of_char_in_string(init_string(str.data + position, chunk_end - position),
+            context->separator);
+        if (found == chunk_end - position)
+            break;
+        size_t separator = position + found;
+        if (open)
+            context->list->items[token++] = sub_string(str, start, separator - start);
+        start = separator + 1;
+        open = true;
+        position = separator + 1;
+    }
+    if (open)
+    {
+        size_t end = chunk_end + index_of_char_in_string(init_string(str.data + chunk_end, str.length - chunk_end),
+            context->separator);
+        context->list->items[token] = sub_string(str, start, end - start);
+    }
+}
+
+/*
+    Runs between the phases of the split: turns the separator counts into
+    the indexes of the first tokens and allocates the list
+*/
+static void allocate_token_list(void *arg)
+{
+    chunked_task_t *context = (chunked_task_t*)arg;
+    size_t total = 1;
+    for (size_t i = 0; i < context->chunk_count; i++)
+    {
+        size_t count = context->counts[i];
+        context->counts[i] = i ? total : 0;
+        total += count;
+    }
+    context->list = nnalloc(sizeof(strings_list_t));
+    context->list->items = nnalloc(sizeof(string_t*) * total);
+    context->list->size = total;
+}
+
+strings_list_t * parallel_split_string(string_t str, char separator, size_t thread_count)
+{
+    size_t chunk_count = get_chunk_count(str.length, &thread_count);
+    if (chunk_count < 2 || thread_count < 2)
+        return split_string(str, separator);
+    chunked_task_t context;
+    chunk_count = init_chunked_task(&context, str, separator, chunk_count);
+    context.counts = nnalloc(sizeof(size_t) * chunk_count);
+    const parallel_phase_t phases[] =
+    {
+        { count_chunk, allocate_token_list },
+        { split_chunk, NULL }
+    };
+    run_parallel_phases(phases, 2, chunk_count, thread_count, &context);
+    free(context.counts);
+    return context.list;
+}
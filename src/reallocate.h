@@ -0,0 +1,28 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Growing of heap blocks: 'realloc' is tried first so that the block
+    can be extended in place; if it fails, a new block is taken
+    from the allocator and only the used part is copied
+*/
+
+#pragma once
+
+#include "allocator.h"
+#include <stdlib.h>
+#include <string.h>
+
+static __inline void * reallocate_block(void *block, size_t used_size, size_t new_size)
+{
+    void *new_block = realloc(block, new_size);
+    if (!new_block)
+    {
+        new_block = nnalloc(new_size);
+        if (block)
+        {
+            memcpy(new_block, block, used_size < new_size ? used_size : new_size);
+            free(block);
+        }
+    }
+    return new_block;
+}
@@ -0,0 +1,81 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    The implementation of the shared string: the counter is placed
+    right before the characters, in the same allocation
+*/
+
+#include "shared_string.h"
+#include "allocator.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+
+struct shared_buffer_t
+{
+    _Atomic size_t references;
+};
+
+shared_string_t make_shared_string(string_t str)
+{
+    shared_string_t result;
+    result.buffer = nnalloc(sizeof(shared_buffer_t) + (str.length + 1) * sizeof(char));
+    atomic_init(&result.buffer->references, 1);
+    result.view.data = (char*)(result.buffer + 1);
+    result.view.length = str.length;
+    memcpy(result.view.data, str.data, str.length * sizeof(char));
+    result.view.data[str.length] = '\0';
+    return result;
+}
+
+shared_wide_string_t make_shared_wide_string(wide_string_t wstr)
+{
+    shared_wide_string_t result;
+    result.buffer = nnalloc(sizeof(shared_buffer_t) + (wstr.length + 1) * sizeof(wchar_t));
+    atomic_init(&result.buffer->references, 1);
+    result.view.data = (wchar_t*)(result.buffer + 1);
+    result.view.length = wstr.length;
+    memcpy(result.view.data, wstr.data, wstr.length * sizeof(wchar_t));
+    result.view.data[wstr.length] = L'\0';
+    return result;
+}
+
+void retain_shared_buffer(shared_buffer_t *buffer)
+{
+    if (buffer)
+        atomic_fetch_add_explicit(&buffer->references, 1, memory_order_relaxed);
+}
+
+/*
+    The last owner must see all the writes made by the others
+    before the memory is freed, hence the acquire-release decrement
+*/
+void release_shared_buffer(shared_buffer_t *buffer)
+{
+    if (buffer && atomic_fetch_sub_explicit(&buffer->references, 1, memory_order_acq_rel) == 1)
+        free(buffer);
+}
+
+size_t get_shared_buffer_reference_count(const shared_buffer_t *buffer)
+{
+    return buffer ? atomic_load_explicit(&((shared_buffer_t*)buffer)->references, memory_order_relaxed) : 0;
+}
+
+shared_string_t shared_sub_string(shared_string_t str, size_t index, size_t length)
+{
+    if (index > str.view.length) index = str.view.length;
+    size_t tail = str.view.length - index;
+    if (length > tail) length = tail;
+    shared_string_t result = { str.buffer, init_string(str.view.data + index, length) };
+    retain_shared_buffer(str.buffer);
+    return result;
+}
+
+shared_wide_string_t shared_sub_wide_string(shared_wide_string_t wstr, size_t index, size_t length)
+{
+    if (index > wstr.view.length) index = wstr.view.length;
+    size_t tail = wstr.view.length - index;
+    if (length > tail) length = tail;
+    shared_wide_string_t result = { wstr.buffer, init_wide_string(wstr.view.data + index, length) };
+    retain_shared_buffer(wstr.buffer);
+    return result;
+}
@@ -0,0 +1,112 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Detection of the instruction sets available for vectorized kernels
+    and bit manipulation helpers shared by these kernels
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if !defined(STRINGS_NO_SIMD)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define STRINGS_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(STRINGS_SSE2) && (defined(__SSSE3__) || defined(__AVX__))
+#define STRINGS_SSSE3
+#include <tmmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define STRINGS_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+static __inline unsigned int count_trailing_zeros(unsigned int mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (unsigned int)index;
+#else
+    return (unsigned int)__builtin_ctz(mask);
+#endif
+}
+
+static __inline unsigned int count_trailing_zeros_64(uint64_t mask)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    return (unsigned int)index;
+#elif defined(_MSC_VER)
+    unsigned int low = (unsigned int)mask;
+    return low ? count_trailing_zeros(low) : 32 + count_trailing_zeros((unsigned int)(mask >> 32));
+#else
+    return (unsigned int)__builtin_ctzll(mask);
+#endif
+}
+
+static __inline unsigned int highest_bit_index(unsigned int mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse(&index, mask);
+    return (unsigned int)index;
+#else
+    return 31 - (unsigned int)__builtin_clz(mask);
+#endif
+}
+
+static __inline unsigned int highest_bit_index_64(uint64_t mask)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanReverse64(&index, mask);
+    return (unsigned int)index;
+#elif defined(_MSC_VER)
+    unsigned int high = (unsigned int)(mask >> 32);
+    return high ? 32 + highest_bit_index(high) : highest_bit_index((unsigned int)mask);
+#else
+    return 63 - (unsigned int)__builtin_clzll(mask);
+#endif
+}
+
+static __inline unsigned int count_bits(unsigned int mask)
+{
+#if defined(_MSC_VER)
+    unsigned int count = 0;
+    while (mask)
+    {
+        mask &= mask - 1;
+        count++;
+    }
+    return count;
+#else
+    return (unsigned int)__builtin_popcount(mask);
+#endif
+}
+
+static __inline uint64_t multiply_64x64(uint64_t a, uint64_t b, uint64_t *high)
+{
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 product = (unsigned __int128)a * b;
+    *high = (uint64_t)(product >> 64);
+    return (uint64_t)product;
+#elif defined(_MSC_VER) && defined(_M_X64)
+    return _umul128(a, b, high);
+#else
+    uint64_t a_lo = (uint32_t)a, a_hi = a >> 32, b_lo = (uint32_t)b, b_hi = b >> 32;
+    uint64_t lo_lo = a_lo * b_lo, hi_lo = a_hi * b_lo, lo_hi = a_lo * b_hi, hi_hi = a_hi * b_hi;
+    uint64_t cross = (lo_lo >> 32) + (uint32_t)hi_lo + lo_hi;
+    *high = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+    return (cross << 32) | (uint32_t)lo_lo;
+#endif
+}
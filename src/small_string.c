@@ -0,0 +1,77 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    The implementation of the small string
+*/
+
+#include "small_string.h"
+#include "allocator.h"
+
+static __inline void fill_small_string(small_string_t *sstr, const char *data, size_t length)
+{
+    char *dst;
+    if (length <= SMALL_STRING_CAPACITY)
+        dst = sstr->content.buffer;
+    else
+        dst = sstr->content.data = nnalloc((length + 1) * sizeof(char));
+    memcpy(dst, data, length * sizeof(char));
+    dst[length] = '\0';
+    sstr->length = length;
+}
+
+small_string_t make_small_string(string_t str)
+{
+    small_string_t sstr;
+    fill_small_string(&sstr, str.data, str.length);
+    return sstr;
+}
+
+small_string_t make_small_sub_string(string_t str, size_t index, size_t length)
+{
+    if (index > str.length) index = str.length;
+    size_t tail = str.length - index;
+    if (length > tail) length = tail;
+    small_string_t sstr;
+    fill_small_string(&sstr, str.data + index, length);
+    return sstr;
+}
+
+void destroy_small_string(small_string_t *sstr)
+{
+    if (!is_small_string_inline(sstr))
+        free(sstr->content.data);
+    sstr->length = 0;
+    sstr->content.buffer[0] = '\0';
+}
+
+string_t * small_string_to_string(const small_string_t *sstr)
+{
+    return duplicate_string(small_string_to_view(sstr));
+}
+
+/*
+    The list and all short tokens occupy a single allocation;
+    only tokens longer than SMALL_STRING_CAPACITY are allocated separately
+*/
+small_strings_list_t * split_string_to_small_strings(string_t str, char separator)
+{
+    size_t count = str.length ? count_of_char_in_string(str, separator) + 1 : 0;
+    small_strings_list_t *list = nnalloc(sizeof(small_strings_list_t) + sizeof(small_string_t) * count);
+    list->items = (small_string_t*)(list + 1);
+    list->size = 0;
+    split_state_t state = init_split_state(str, separator);
+    string_t token;
+    while (split_next(&state, &token))
+        fill_small_string(&list->items[list->size++], token.data, token.length);
+    return list;
+}
+
+void destroy_small_strings_list(small_strings_list_t *list)
+{
+    for (size_t i = 0; i < list->size; i++)
+    {
+        if (!is_small_string_inline(&list->items[i]))
+            free(list->items[i].content.data);
+    }
+    free(list);
+}
@@ -0,0 +1,99 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Hooks collecting the allocation and copy statistics; they expand
+    to nothing unless the library is compiled with STRINGS_STATS defined.
+    Every thread owns a block of counters that only this thread writes,
+    other threads just read it when aggregating
+*/
+
+#pragma once
+
+#include "string_stats.h"
+
+#ifdef STRINGS_STATS
+
+#include <stdatomic.h>
+
+#if defined(_MSC_VER)
+#define STATS_THREAD_LOCAL __declspec(thread)
+#else
+#define STATS_THREAD_LOCAL _Thread_local
+#endif
+
+#define STATS_NO_SCOPE STRING_STATS_FUNCTION_COUNT
+
+typedef struct stats_block_t
+{
+    _Atomic uint64_t counters[STRING_STATS_FUNCTION_COUNT][4];
+    _Atomic uint64_t capacity_histogram[STRING_STATS_HISTOGRAM_SIZE];
+    string_stats_function_t scope;
+    struct stats_block_t *next;
+} stats_block_t;
+
+extern STATS_THREAD_LOCAL stats_block_t *thread_stats_block;
+stats_block_t * register_thread_stats_block(void);
+
+static __inline stats_block_t * get_stats_block(void)
+{
+    stats_block_t *block = thread_stats_block;
+    return block ? block : register_thread_stats_block();
+}
+
+static __inline void add_stats_value(_Atomic uint64_t *counter, uint64_t value)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value,
+        memory_order_relaxed);
+}
+
+static __inline void record_stats(string_stats_function_t function, int index, uint64_t value)
+{
+    stats_block_t *block = get_stats_block();
+    if (block->scope != STATS_NO_SCOPE)
+        function = block->scope;
+    add_stats_value(&block->counters[function][index], value);
+}
+
+static __inline void record_allocation_stats(string_stats_function_t function, size_t size)
+{
+    record_stats(function, 0, 1);
+    record_stats(function, 1, size);
+}
+
+static __inline void record_capacity_stats(size_t capacity)
+{
+    int bucket = 0;
+    while (capacity)
+    {
+        capacity >>= 1;
+        bucket++;
+    }
+    add_stats_value(&get_stats_block()->capacity_histogram[bucket], 1);
+}
+
+static __inline string_stats_function_t enter_stats_scope(string_stats_function_t function)
+{
+    stats_block_t *block = get_stats_block();
+    string_stats_function_t previous = block->scope;
+    if (previous == STATS_NO_SCOPE)
+        block->scope = function;
+    return previous;
+}
+
+#define STATS_ALLOCATION(function, size) record_allocation_stats(function, size)
+#define STATS_COPY(function, size) record_stats(function, 2, size)
+#define STATS_WASTE(function, size) record_stats(function, 3, size)
+#define STATS_CAPACITY(capacity) record_capacity_stats(capacity)
+#define STATS_ENTER(function) string_stats_function_t stats_saved_scope = enter_stats_scope(function)
+#define STATS_LEAVE() (get_stats_block()->scope = stats_saved_scope)
+
+#else
+
+#define STATS_ALLOCATION(function, size) ((void)(function), (void)(size))
+#define STATS_COPY(function, size) ((void)(function), (void)(size))
+#define STATS_WASTE(function, size) ((void)(function), (void)(size))
+#define STATS_CAPACITY(capacity) ((void)(capacity))
+#define STATS_ENTER(function)
+#define STATS_LEAVE() ((void)0)
+
+#endif
@@ -0,0 +1,307 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    The implementation of the arena (bump-pointer allocator) for strings
+*/
+
+#include "string_arena.h"
+#include "allocator.h"
+
+static const size_t initial_capacity = 16;
+static const size_t default_chunk_size = 65536;
+
+struct string_arena_chunk_t
+{
+    string_arena_chunk_t *next;
+    size_t capacity;
+};
+
+static __inline size_t align_size(size_t size)
+{
+    return (size + STRING_ARENA_ALIGNMENT - 1) & ~(STRING_ARENA_ALIGNMENT - 1);
+}
+
+static __inline char * get_chunk_data(string_arena_chunk_t *chunk)
+{
+    return (char*)chunk + align_size(sizeof(string_arena_chunk_t));
+}
+
+static string_arena_chunk_t * create_chunk(size_t capacity)
+{
+    string_arena_chunk_t *chunk = nnalloc(align_size(sizeof(string_arena_chunk_t)) + capacity);
+    chunk->next = NULL;
+    chunk->capacity = capacity;
+    return chunk;
+}
+
+static void select_chunk(string_arena_t *arena, string_arena_chunk_t *chunk)
+{
+    arena->current = chunk;
+    arena->top = get_chunk_data(chunk);
+    arena->end = arena->top + chunk->capacity;
+}
+
+string_arena_t * create_string_arena(size_t chunk_size)
+{
+    string_arena_t *arena = nnalloc(sizeof(string_arena_t));
+    arena->chunk_size = align_size(chunk_size ? chunk_size : default_chunk_size);
+    arena->first = create_chunk(arena->chunk_size);
+    select_chunk(arena, arena->first);
+    return arena;
+}
+
+void destroy_string_arena(string_arena_t *arena)
+{
+    string_arena_chunk_t *chunk = arena->first;
+    while (chunk)
+    {
+        string_arena_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(arena);
+}
+
+void reset_string_arena(string_arena_t *arena)
+{
+    select_chunk(arena, arena->first);
+}
+
+void * allocate_in_new_arena_chunk(string_arena_t *arena, size_t size)
+{
+    string_arena_chunk_t *chunk = arena->current->next;
+    if (!chunk || chunk->capacity < size)
+    {
+        chunk = create_chunk(size > arena->chunk_size ? size : arena->chunk_size);
+        chunk->next = arena->current->next;
+        arena->current->next = chunk;
+    }
+    select_chunk(arena, chunk);
+    void *block = arena->top;
+    arena->top += size;
+    return block;
+}
+
+string_t * duplicate_string_in_arena(string_arena_t *arena, string_t str)
+{
+    string_t *copy = allocate_in_arena(arena, sizeof(string_t) + (str.length + 1) * sizeof(char));
+    copy->data = (char*)(copy + 1);
+    copy->length = str.length;
+    memcpy(copy->data, str.data, str.length * sizeof(char));
+    copy->data[str.length] = '\0';
+    return copy;
+}
+
+wide_string_t * duplicate_wide_string_in_arena(string_arena_t *arena, wide_string_t wstr)
+{
+    wide_string_t *copy = allocate_in_arena(arena, sizeof(wide_string_t) + (wstr.length + 1) * sizeof(wchar_t));
+    copy->data = (wchar_t*)(copy + 1);
+    copy->length = wstr.length;
+    memcpy(copy->data, wstr.data, wstr.length * sizeof(wchar_t));
+    copy->data[wstr.length] = L'\0';
+    return copy;
+}
+
+string_t * sub_string_in_arena(string_arena_t *arena, string_t str, size_t index, size_t length)
+{
+    if (index > str.length) index = str.length;
+    size_t tail = str.length - index;
+    if (length > tail) length = tail;
+    return duplicate_string_in_arena(arena, init_string(str.data + index, length));
+}
+
+wide_string_t * sub_wide_string_in_arena(string_arena_t *arena, wide_string_t wstr, size_t index, size_t length)
+{
+    if (index > wstr.length) index = wstr.length;
+    size_t tail = wstr.length - index;
+    if (length > tail) length = tail;
+    return duplicate_wide_string_in_arena(arena, init_wide_string(wstr.data + index, length));
+}
+
+strings_list_t * split_string_in_arena(string_arena_t *arena, string_t str, char separator)
+{
+    strings_list_t *list = allocate_in_arena(arena, sizeof(strings_list_t));
+    list->size = 0;
+    if (!str.length)
+    {
+        list->items = NULL;
+        return list;
+    }
+    size_t count = count_of_char_in_string(str, separator) + 1;
+    list->items = allocate_in_arena(arena, sizeof(string_t*) * count);
+    split_state_t state = init_split_state(str, separator);
+    string_t token;
+    while (split_next(&state, &token))
+        list->items[list->size++] = duplicate_string_in_arena(arena, token);
+    return list;
+}
+
+wide_strings_list_t * split_wide_string_in_arena(string_arena_t *arena, wide_string_t wstr, wchar_t separator)
+{
+    wide_strings_list_t *list = allocate_in_arena(arena, sizeof(wide_strings_list_t));
+    list->size = 0;
+    if (!wstr.length)
+    {
+        list->items = NULL;
+        return list;
+    }
+    size_t count = count_of_char_in_wide_string(wstr, separator) + 1;
+    list->items = allocate_in_arena(arena, sizeof(wide_string_t*) * count);
+    wide_split_state_t state = init_wide_split_state(wstr, separator);
+    wide_string_t token;
+    while (split_wide_next(&state, &token))
+        list->items[list->size++] = duplicate_wide_string_in_arena(arena, token);
+    return list;
+}
+
+string_t * wide_string_to_string_in_arena(string_arena_t *arena, wide_string_t wstr, char bad_char, bool *was_bad_char)
+{
+    bool bad_flag = false;
+    string_t *str = allocate_in_arena(arena, sizeof(string_t) + (wstr.length + 1) * sizeof(char));
+    str->data = (char*)(str + 1);
+    str->data[wstr.length] = '\0';
+    str->length = wstr.length;
+    for (size_t i = 0; i < wstr.length; i++)
+    {
+        wchar_t c = wstr.data[i];
+        if (c < 128)
+        {
+            str->data[i] = (char)c;
+        }
+        else
+        {
+            str->data[i] = bad_char;
+            bad_flag = true;
+        }
+    }
+    if (was_bad_char) *was_bad_char = bad_flag;
+    return str;
+}
+
+static __inline size_t get_string_builder_size(size_t capacity)
+{
+    return align_size(sizeof(string_builder_t) + sizeof(char) * (capacity + 1));
+}
+
+static __inline size_t get_wide_string_builder_size(size_t capacity)
+{
+    return align_size(sizeof(wide_string_builder_t) + sizeof(wchar_t) * (capacity + 1));
+}
+
+string_builder_t * create_string_builder_in_arena(string_arena_t *arena, size_t capacity)
+{
+    string_builder_t *obj = allocate_in_arena(arena, get_string_builder_size(capacity));
+    obj->data = (char*)(obj + 1);
+    obj->data[0] = '\0';
+    obj->length = 0;
+    obj->capacity = capacity;
+    return obj;
+}
+
+wide_string_builder_t * create_wide_string_builder_in_arena(string_arena_t *arena, size_t capacity)
+{
+    wide_string_builder_t *obj = allocate_in_arena(arena, get_wide_string_builder_size(capacity));
+    obj->data = (wchar_t*)(obj + 1);
+    obj->data[0] = L'\0';
+    obj->length = 0;
+    obj->capacity = capacity;
+    return obj;
+}
+
+static string_builder_t * grow_string_builder_in_arena(string_arena_t *arena, string_builder_t *obj, size_t new_length)
+{
+    size_t new_capacity = obj->capacity ? obj->capacity * 2 : initial_capacity;
+    if (new_capacity < new_length) new_capacity = new_length;
+    size_t old_size = get_string_builder_size(obj->capacity);
+    size_t extra = get_string_builder_size(new_capacity) - old_size;
+    if ((char*)obj + old_size == arena->top && (size_t)(arena->end - arena->top) >= extra)
+    {
+        arena->top += extra;
+        obj->capacity = new_capacity;
+        return obj;
+    }
+    string_builder_t *new_obj = create_string_builder_in_arena(arena, new_capacity);
+    memcpy(new_obj->data, obj->data, (obj->length + 1) * sizeof(char));
+    new_obj->length = obj->length;
+    return new_obj;
+}
+
+static wide_string_builder_t * grow_wide_string_builder_in_arena(string_arena_t *arena, wide_string_builder_t *obj, size_t new_length)
+{
+    size_t new_capacity = obj->capacity ? obj->capacity * 2 : initial_capacity;
+    if (new_capacity < new_length) new_capacity = new_length;
+    size_t old_size = get_wide_string_builder_size(obj->capacity);
+    size_t extra = get_wide_string_builder_size(new_capacity) - old_size;
+    if ((char*)obj + old_size == arena->top && (size_t)(arena->end - arena->top) >= extra)
+    {
+        arena->top += extra;
+        obj->capacity = new_capacity;
+        return obj;
+    }
+    wide_string_builder_t *new_obj = create_wide_string_builder_in_arena(arena, new_capacity);
+    memcpy(new_obj->data, obj->data, (obj->length + 1) * sizeof(wchar_t));
+    new_obj->length = obj->length;
+    return new_obj;
+}
+
+string_builder_t * append_char_in_arena(string_arena_t *arena, string_builder_t *obj, char ch)
+{
+    if (!obj)
+        obj = create_string_builder_in_arena(arena, initial_capacity);
+    else if (obj->length == obj->capacity)
+        obj = grow_string_builder_in_arena(arena, obj, obj->length + 1);
+    obj->data[obj->length++] = ch;
+    obj->data[obj->length] = '\0';
+    return obj;
+}
+
+wide_string_builder_t * append_wide_char_in_arena(string_arena_t *arena, wide_string_builder_t *obj, wchar_t ch)
+{
+    if (!obj)
+        obj = create_wide_string_builder_in_arena(arena, initial_capacity);
+    else if (obj->length == obj->capacity)
+        obj = grow_wide_string_builder_in_arena(arena, obj, obj->length + 1);
+    obj->data[obj->length++] = ch;
+    obj->data[obj->length] = L'\0';
+    return obj;
+}
+
+string_builder_t * append_string_in_arena(string_arena_t *arena, string_builder_t *obj, string_t str)
+{
+    size_t new_length;
+    if (!obj)
+    {
+        obj = create_string_builder_in_arena(arena, str.length > initial_capacity ? str.length : initial_capacity);
+        new_length = str.length;
+    }
+    else
+    {
+        new_length = obj->length + str.length;
+        if (new_length > obj->capacity)
+            obj = grow_string_builder_in_arena(arena, obj, new_length);
+    }
+    memcpy(obj->data + obj->length, str.data, str.length * sizeof(char));
+    obj->data[new_length] = '\0';
+    obj->length = new_length;
+    return obj;
+}
+
+wide_string_builder_t * append_wide_string_in_arena(string_arena_t *arena, wide_string_builder_t *obj, wide_string_t wstr)
+{
+    size_t new_length;
+    if (!obj)
+    {
+        obj = create_wide_string_builder_in_arena(arena, wstr.length > initial_capacity ? wstr.length : initial_capacity);
+        new_length = wstr.length;
+    }
+    else
+    {
+        new_length = obj->length + wstr.length;
+        if (new_length > obj->capacity)
+            obj = grow_wide_string_builder_in_arena(arena, obj, new_length);
+    }
+    memcpy(obj->data + obj->length, wstr.data, wstr.length * sizeof(wchar_t));
+    obj->data[new_length] = L'\0';
+    obj->length = new_length;
+    return obj;
+}
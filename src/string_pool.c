@@ -0,0 +1,104 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    The implementation of the pool of interned strings
+    (open addressing with linear probing)
+*/
+
+#include "string_pool.h"
+#include "allocator.h"
+
+static const size_t minimal_capacity = 16;
+
+static string_pool_slot_t * allocate_slots(size_t capacity)
+{
+    string_pool_slot_t *slots = nnalloc(sizeof(string_pool_slot_t) * capacity);
+    memset(slots, 0, sizeof(string_pool_slot_t) * capacity);
+    return slots;
+}
+
+string_pool_t * create_string_pool(size_t capacity)
+{
+    size_t slots_count = minimal_capacity;
+    while (slots_count / 4 * 3 < capacity)
+        slots_count *= 2;
+    string_pool_t *pool = nnalloc(sizeof(string_pool_t));
+    pool->slots = allocate_slots(slots_count);
+    pool->capacity = slots_count;
+    pool->count = 0;
+    pool->arena = create_string_arena(0);
+    return pool;
+}
+
+void destroy_string_pool(string_pool_t *pool)
+{
+    destroy_string_arena(pool->arena);
+    free(pool->slots);
+    free(pool);
+}
+
+static string_pool_slot_t * find_slot(string_pool_slot_t *slots, size_t capacity, string_t str, uint64_t hash)
+{
+    size_t mask = capacity - 1;
+    size_t index = (size_t)hash & mask;
+    for (;;)
+    {
+        string_pool_slot_t *slot = &slots[index];
+        if (!slot->item)
+            return slot;
+        if (slot->hash == hash && slot->item->str.length == str.length
+                && (!str.length || 0 == memcmp(slot->item->str.data, str.data, str.length)))
+            return slot;
+        index = (index + 1) & mask;
+    }
+}
+
+static void grow_pool(string_pool_t *pool)
+{
+    size_t capacity = pool->capacity * 2;
+    string_pool_slot_t *slots = allocate_slots(capacity);
+    for (size_t i = 0; i < pool->capacity; i++)
+    {
+        string_pool_slot_t *slot = &pool->slots[i];
+        if (slot->item)
+        {
+            size_t index = (size_t)slot->hash & (capacity - 1);
+            while (slots[index].item)
+                index = (index + 1) & (capacity - 1);
+            slots[index] = *slot;
+        }
+    }
+    free(pool->slots);
+    pool->slots = slots;
+    pool->capacity = capacity;
+}
+
+const interned_string_t * intern_string(string_pool_t *pool, string_t str)
+{
+    uint64_t hash = hash_string(str);
+    string_pool_slot_t *slot = find_slot(pool->slots, pool->capacity, str, hash);
+    if (slot->item)
+        return slot->item;
+    if ((pool->count + 1) > pool->capacity / 4 * 3)
+    {
+        grow_pool(pool);
+        slot = find_slot(pool->slots, pool->capacity, str, hash);
+    }
+    interned_string_t *item = allocate_in_arena(pool->arena, sizeof(interned_string_t) + str.length + 1);
+    item->str.data = (char*)(item + 1);
+    item->str.length = str.length;
+    if (str.length)
+        memcpy(item->str.data, str.data, str.length);
+    item->str.data[str.length] = '\0';
+    item->hash = hash;
+    slot->hash = hash;
+    slot->item = item;
+    pool->count++;
+    return item;
+}
+
+const interned_string_t * find_interned_string(const string_pool_t *pool, string_t str)
+{
+    uint64_t hash = hash_string(str);
+    return find_slot(pool->slots, pool->capacity, str, hash)->item;
+}
@@ -0,0 +1,234 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    The implementation of the rope (chunked string builder)
+*/
+
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
+#include "string_rope.h"
+#include "allocator.h"
+#include <limits.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <errno.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#if !defined(IOV_MAX)
+#define IOV_MAX 1024
+#endif
+
+static const size_t default_chunk_size = 64 * 1024;
+
+struct string_rope_chunk_t
+{
+    string_rope_chunk_t *next;
+    size_t length;
+    size_t capacity;
+};
+
+static __inline char * get_chunk_data(string_rope_chunk_t *chunk)
+{
+    return (char*)(chunk + 1);
+}
+
+static string_rope_chunk_t * add_chunk(string_rope_t *rope, size_t capacity)
+{
+    string_rope_chunk_t *chunk = nnalloc(sizeof(string_rope_chunk_t) + capacity * sizeof(char));
+    chunk->next = NULL;
+    chunk->length = 0;
+    chunk->capacity = capacity;
+    if (rope->last)
+        rope->last->next = chunk;
+    else
+        rope->first = chunk;
+    rope->last = chunk;
+    return chunk;
+}
+
+string_rope_t * create_string_rope(size_t chunk_size)
+{
+    string_rope_t *rope = nnalloc(sizeof(string_rope_t));
+    rope->first = NULL;
+    rope->last = NULL;
+    rope->length = 0;
+    rope->chunk_size = chunk_size ? chunk_size : default_chunk_size;
+    rope->scratch = NULL;
+    return rope;
+}
+
+void destroy_string_rope(string_rope_t *rope)
+{
+    string_rope_chunk_t *chunk = rope->first;
+    while (chunk)
+    {
+        string_rope_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(rope->scratch);
+    free(rope);
+}
+
+string_rope_t * append_char_to_rope(string_rope_t *rope, char ch)
+{
+    if (!rope)
+        rope = create_string_rope(0);
+    string_rope_chunk_t *chunk = rope->last;
+    if (!chunk || chunk->length == chunk->capacity)
+        chunk = add_chunk(rope, rope->chunk_size);
+    get_chunk_data(chunk)[chunk->length++] = ch;
+    rope->length++;
+    return rope;
+}
+
+/*
+    The tail of the string that does not fit into the last chunk goes
+    to a new chunk, sized to hold it entirely, so every byte is copied once
+*/
+string_rope_t * append_string_to_rope(string_rope_t *rope, string_t str)
+{
+    if (!rope)
+        rope = create_string_rope(0);
+    if (!str.length)
+        return rope;
+    string_rope_chunk_t *chunk = rope->last;
+    size_t offset = 0;
+    if (chunk)
+    {
+        offset = chunk->capacity - chunk->length;
+        if (offset > str.length)
+            offset = str.length;
+        memcpy(get_chunk_data(chunk) + chunk->length, str.data, offset * sizeof(char));
+        chunk->length += offset;
+    }
+    size_t rest = str.length - offset;
+    if (rest)
+    {
+        chunk = add_chunk(rope, rest > rope->chunk_size ? rest : rope->chunk_size);
+        memcpy(get_chunk_data(chunk), str.data + offset, rest * sizeof(char));
+        chunk->length = rest;
+    }
+    rope->length += str.length;
+    return rope;
+}
+
+string_rope_t * append_formatted_string_to_rope_ext(string_rope_t *rope, const char *format, va_list arg_list)
+{
+    if (!rope)
+        rope = create_string_rope(0);
+    if (rope->scratch)
+        rope->scratch->length = 0;
+    else
+        rope->scratch = create_string_builder(0);
+    rope->scratch = append_formatted_string_ext(rope->scratch, format, arg_list);
+    return append_string_to_rope(rope, init_string(rope->scratch->data, rope->scratch->length));
+}
+
+string_rope_t * concat_ropes(string_rope_t *rope, string_rope_t *tail)
+{
+    if (!rope)
+        rope = create_string_rope(0);
+    if (tail->first)
+    {
+        if (rope->last)
+            rope->last->next = tail->first;
+        else
+            rope->first = tail->first;
+        rope->last = tail->last;
+        rope->length += tail->length;
+    }
+    free(tail->scratch);
+    free(tail);
+    return rope;
+}
+
+string_t * flatten_rope(const string_rope_t *rope)
+{
+    string_t *str = nnalloc(sizeof(string_t) + (rope->length + 1) * sizeof(char));
+    str->data = (char*)(str + 1);
+    str->length = rope->length;
+    char *dst = str->data;
+    for (string_rope_chunk_t *chunk = rope->first; chunk; chunk = chunk->next)
+    {
+        memcpy(dst, get_chunk_data(chunk), chunk->length * sizeof(char));
+        dst += chunk->length;
+    }
+    *dst = '\0';
+    return str;
+}
+
+#ifdef _WIN32
+bool write_rope_to_file(const string_rope_t *rope, int fd)
+{
+    for (string_rope_chunk_t *chunk = rope->first; chunk; chunk = chunk->next)
+    {
+        const char *data = get_chunk_data(chunk);
+        size_t rest = chunk->length;
+        while (rest)
+        {
+            unsigned int portion = rest > INT_MAX ? INT_MAX : (unsigned int)rest;
+            int written = _write(fd, data, portion);
+            if (written <= 0)
+                return false;
+            data += written;
+            rest -= written;
+        }
+    }
+    return true;
+}
+#else
+/*
+    Chunks are passed to writev in batches of at most IOV_MAX entries;
+    after a partial write the batch is advanced past the written bytes
+*/
+bool write_rope_to_file(const string_rope_t *rope, int fd)
+{
+    struct iovec vector[IOV_MAX < 1024 ? IOV_MAX : 1024];
+    const int max_count = (int)(sizeof(vector) / sizeof(vector[0]));
+    string_rope_chunk_t *chunk = rope->first;
+    while (chunk)
+    {
+        int count = 0;
+        for (; chunk && count < max_count; chunk = chunk->next)
+        {
+            if (chunk->length)
+            {
+                vector[count].iov_base = get_chunk_data(chunk);
+                vector[count].iov_len = chunk->length;
+                count++;
+            }
+        }
+        struct iovec *pending = vector;
+        while (count)
+        {
+            ssize_t written = writev(fd, pending, count);
+            if (written <= 0)
+            {
+                if (written < 0 && errno == EINTR)
+                    continue;
+                return false;
+            }
+            size_t rest = (size_t)written;
+            while (count && rest >= pending->iov_len)
+            {
+                rest -= pending->iov_len;
+                pending++;
+                count--;
+            }
+            if (count)
+            {
+                pending->iov_base = (char*)pending->iov_base + rest;
+                pending->iov_len -= rest;
+            }
+        }
+    }
+    return true;
+}
+#endif
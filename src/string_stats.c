@@ -0,0 +1,163 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    The implementation of the aggregation and the dump
+    of the allocation and copy statistics
+*/
+
+#include "stats.h"
+#include "allocator.h"
+
+static const char *function_names[STRING_STATS_FUNCTION_COUNT] =
+{
+    "create_string_builder",
+    "reserve_string_builder",
+    "shrink_string_builder",
+    "append_char",
+    "append_string",
+    "append_formatted_string",
+    "compile_format",
+    "append_compiled_format",
+    "duplicate_string",
+    "decode_utf8_string",
+    "encode_utf8_string",
+    "read_file_to_string",
+    "map_file_to_string",
+    "wide_string_to_string",
+    "sub_string",
+    "split_string",
+    "split_string_to_views",
+    "change_case",
+    "join_concat"
+};
+
+const char * get_string_stats_function_name(string_stats_function_t function)
+{
+    return function < STRING_STATS_FUNCTION_COUNT ? function_names[function] : "";
+}
+
+#ifdef STRINGS_STATS
+
+STATS_THREAD_LOCAL stats_block_t *thread_stats_block = NULL;
+
+static _Atomic(stats_block_t*) all_stats_blocks = NULL;
+
+/*
+    Blocks are never released: the counters of finished threads
+    remain a part of the aggregated statistics
+*/
+stats_block_t * register_thread_stats_block(void)
+{
+    stats_block_t *block = nnalloc(sizeof(stats_block_t));
+    for (int i = 0; i < STRING_STATS_FUNCTION_COUNT; i++)
+    {
+        for (int k = 0; k < 4; k++)
+            atomic_init(&block->counters[i][k], 0);
+    }
+    for (int i = 0; i < STRING_STATS_HISTOGRAM_SIZE; i++)
+        atomic_init(&block->capacity_histogram[i], 0);
+    block->scope = STATS_NO_SCOPE;
+    stats_block_t *head = atomic_load(&all_stats_blocks);
+    do
+    {
+        block->next = head;
+    } while (!atomic_compare_exchange_weak(&all_stats_blocks, &head, block));
+    thread_stats_block = block;
+    return block;
+}
+
+static void add_block_to_stats(string_stats_t *stats, stats_block_t *block)
+{
+    for (int i = 0; i < STRING_STATS_FUNCTION_COUNT; i++)
+    {
+        string_stats_counters_t *counters = &stats->functions[i];
+        counters->allocations += atomic_load_explicit(&block->counters[i][0], memory_order_relaxed);
+        counters->bytes_allocated += atomic_load_explicit(&block->counters[i][1], memory_order_relaxed);
+        counters->bytes_copied += atomic_load_explicit(&block->counters[i][2], memory_order_relaxed);
+        counters->bytes_wasted += atomic_load_explicit(&block->counters[i][3], memory_order_relaxed);
+    }
+    for (int i = 0; i < STRING_STATS_HISTOGRAM_SIZE; i++)
+        stats->capacity_histogram[i] += atomic_load_explicit(&block->capacity_histogram[i], memory_order_relaxed);
+}
+
+bool are_string_stats_enabled(void)
+{
+    return true;
+}
+
+void get_thread_string_stats(string_stats_t *stats)
+{
+    memset(stats, 0, sizeof(string_stats_t));
+    add_block_to_stats(stats, get_stats_block());
+}
+
+void get_string_stats(string_stats_t *stats)
+{
+    memset(stats, 0, sizeof(string_stats_t));
+    for (stats_block_t *block = atomic_load(&all_stats_blocks); block; block = block->next)
+        add_block_to_stats(stats, block);
+}
+
+void reset_thread_string_stats(void)
+{
+    stats_block_t *block = get_stats_block();
+    for (int i = 0; i < STRING_STATS_FUNCTION_COUNT; i++)
+    {
+        for (int k = 0; k < 4; k++)
+            atomic_store_explicit(&block->counters[i][k], 0, memory_order_relaxed);
+    }
+    for (int i = 0; i < STRING_STATS_HISTOGRAM_SIZE; i++)
+        atomic_store_explicit(&block->capacity_histogram[i], 0, memory_order_relaxed);
+}
+
+#else
+
+bool are_string_stats_enabled(void)
+{
+    return false;
+}
+
+void get_thread_string_stats(string_stats_t *stats)
+{
+    memset(stats, 0, sizeof(string_stats_t));
+}
+
+void get_string_stats(string_stats_t *stats)
+{
+    memset(stats, 0, sizeof(string_stats_t));
+}
+
+void reset_thread_string_stats(void)
+{
+}
+
+#endif
+
+/*
+    One line per function with non-zero counters followed by
+    the non-empty buckets of the capacity histogram
+*/
+string_t * dump_string_stats(const string_stats_t *stats)
+{
+    string_builder_t *b = create_string_builder(1024);
+    for (int i = 0; i < STRING_STATS_FUNCTION_COUNT; i++)
+    {
+        const string_stats_counters_t *counters = &stats->functions[i];
+        if (!counters->allocations && !counters->bytes_copied && !counters->bytes_wasted)
+            continue;
+        b = append_formatted_string(b, "%s: %llu allocations, %llu bytes allocated, %llu bytes copied, %llu bytes wasted\n",
+            function_names[i], (unsigned long long)counters->allocations,
+            (unsigned long long)counters->bytes_allocated, (unsigned long long)counters->bytes_copied,
+            (unsigned long long)counters->bytes_wasted);
+    }
+    for (int i = 0; i < STRING_STATS_HISTOGRAM_SIZE; i++)
+    {
+        if (!stats->capacity_histogram[i])
+            continue;
+        unsigned long long low = i ? 1ull << (i - 1) : 0,
+            high = i ? (i < 64 ? (1ull << i) - 1 : ~0ull) : 0;
+        b = append_formatted_string(b, "capacity %llu..%llu: %llu\n", low, high,
+            (unsigned long long)stats->capacity_histogram[i]);
+    }
+    return (string_t*)b;
+}
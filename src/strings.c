@@ -4,26 +4,103 @@
     The implementation of the strings library
 */
 
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
 #include "strings.h"
 #include "allocator.h"
+#include "simd.h"
+#include "number_format.h"
+#include "stats.h"
+#include "reallocate.h"
+#include "unicode_tables.h"
 #include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <float.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 static const size_t initial_capacity = 16;
 
-static __inline string_builder_t * instantiate_string_builder(size_t capacity)
+static size_t double_capacity(size_t capacity, size_t required)
+{
+    (void)required;
+    return capacity ? capacity * 2 : initial_capacity;
+}
+
+static string_builder_growth_policy_t growth_policy = double_capacity;
+
+void set_string_builder_growth_policy(string_builder_growth_policy_t policy)
+{
+    growth_policy = policy ? policy : double_capacity;
+}
+
+static __inline size_t get_new_capacity(size_t capacity, size_t required)
+{
+    size_t new_capacity = growth_policy(capacity, required);
+    return new_capacity < required ? required : new_capacity;
+}
+
+static void * reallocate(void *block, size_t old_size, size_t new_size, string_stats_function_t function)
+{
+    uintptr_t old_address = (uintptr_t)block;
+    void *new_block = reallocate_block(block, old_size, new_size);
+    STATS_ALLOCATION(function, new_size);
+    if ((uintptr_t)new_block != old_address)
+        STATS_COPY(function, old_size < new_size ? old_size : new_size);
+    return new_block;
+}
+
+static __inline string_builder_t * instantiate_string_builder(size_t capacity, string_stats_function_t function)
 {
     size_t size = sizeof(string_builder_t) + sizeof(char) * (capacity + 1);
     string_builder_t *obj = nnalloc(size);
+    STATS_ALLOCATION(function, size);
+    STATS_CAPACITY(capacity);
     obj->data = (char*)(obj + 1);
     obj->capacity = capacity;
     return obj;
 }
 
-static __inline wide_string_builder_t * instantiate_wide_string_builder(size_t capacity)
+static __inline wide_string_builder_t * instantiate_wide_string_builder(size_t capacity, string_stats_function_t function)
 {
     size_t size = sizeof(wide_string_builder_t) + sizeof(wchar_t) * (capacity + 1);
     wide_string_builder_t *obj = nnalloc(size);
+    STATS_ALLOCATION(function, size);
+    STATS_CAPACITY(capacity);
+    obj->data = (wchar_t*)(obj + 1);
+    obj->capacity = capacity;
+    return obj;
+}
+
+static string_builder_t * resize_string_builder(string_builder_t *obj, size_t capacity,
+    string_stats_function_t function)
+{
+    size_t old_size = sizeof(string_builder_t) + sizeof(char) * (obj->length + 1);
+    size_t new_size = sizeof(string_builder_t) + sizeof(char) * (capacity + 1);
+    obj = reallocate(obj, old_size, new_size, function);
+    STATS_CAPACITY(capacity);
+    obj->data = (char*)(obj + 1);
+    obj->capacity = capacity;
+    return obj;
+}
+
+static wide_string_builder_t * resize_wide_string_builder(wide_string_builder_t *obj, size_t capacity,
+    string_stats_function_t function)
+{
+    size_t old_size = sizeof(wide_string_builder_t) + sizeof(wchar_t) * (obj->length + 1);
+    size_t new_size = sizeof(wide_string_builder_t) + sizeof(wchar_t) * (capacity + 1);
+    obj = reallocate(obj, old_size, new_size, function);
+    STATS_CAPACITY(capacity);
     obj->data = (wchar_t*)(obj + 1);
     obj->capacity = capacity;
     return obj;
@@ -31,7 +108,7 @@ static __inline wide_string_builder_t * instantiate_wide_string_builder(size_t c
 
 string_builder_t * create_string_builder(size_t capacity)
 {
-    string_builder_t *obj = instantiate_string_builder(capacity);
+    string_builder_t *obj = instantiate_string_builder(capacity, STRING_STATS_CREATE_BUILDER);
     obj->data[0] = '\0';
     obj->length = 0;
     return obj;
@@ -39,68 +116,78 @@ string_builder_t * create_string_builder(size_t capacity)
 
 wide_string_builder_t * create_wide_string_builder(size_t capacity)
 {
-    wide_string_builder_t *obj = instantiate_wide_string_builder(capacity);
+    wide_string_builder_t *obj = instantiate_wide_string_builder(capacity, STRING_STATS_CREATE_BUILDER);
     obj->data[0] = L'\0';
     obj->length = 0;
     return obj;
 }
 
+string_builder_t * reserve_string_builder(string_builder_t *obj, size_t capacity)
+{
+    if (!obj)
+        return create_string_builder(capacity);
+    if (obj->capacity >= capacity)
+        return obj;
+    return resize_string_builder(obj, capacity, STRING_STATS_RESERVE);
+}
+
+wide_string_builder_t * reserve_wide_string_builder(wide_string_builder_t *obj, size_t capacity)
+{
+    if (!obj)
+        return create_wide_string_builder(capacity);
+    if (obj->capacity >= capacity)
+        return obj;
+    return resize_wide_string_builder(obj, capacity, STRING_STATS_RESERVE);
+}
+
+string_builder_t * shrink_string_builder(string_builder_t *obj)
+{
+    if (obj->capacity == obj->length)
+        return obj;
+    STATS_WASTE(STRING_STATS_SHRINK, (obj->capacity - obj->length) * sizeof(char));
+    return resize_string_builder(obj, obj->length, STRING_STATS_SHRINK);
+}
+
+wide_string_builder_t * shrink_wide_string_builder(wide_string_builder_t *obj)
+{
+    if (obj->capacity == obj->length)
+        return obj;
+    STATS_WASTE(STRING_STATS_SHRINK, (obj->capacity - obj->length) * sizeof(wchar_t));
+    return resize_wide_string_builder(obj, obj->length, STRING_STATS_SHRINK);
+}
+
 string_builder_t * append_char(string_builder_t *obj, char ch)
 {
     if (!obj)
     {
-        obj = instantiate_string_builder(initial_capacity);
+        obj = instantiate_string_builder(initial_capacity, STRING_STATS_APPEND_CHAR);
         obj->data[0] = ch;
         obj->data[1] = '\0';
         obj->length = 1;
         return obj;
     }
-    else if (obj->capacity > obj->length)
-    {
-        obj->data[obj->length++] = ch;
-        obj->data[obj->length] = '\0';
-        return obj;
-    }
-    else
-    {
-        size_t new_capacity = obj->capacity ? obj->capacity * 2 : initial_capacity;
-        string_builder_t *new_obj = instantiate_string_builder(new_capacity);
-        new_obj->length = obj->length + 1;
-        memcpy(new_obj->data, obj->data, obj->length * sizeof(char));
-        new_obj->data[obj->length] = ch;
-        new_obj->data[new_obj->length] = '\0';
-        free(obj);
-        return new_obj;
-    }
+    if (obj->capacity == obj->length)
+        obj = resize_string_builder(obj, get_new_capacity(obj->capacity, obj->length + 1), STRING_STATS_APPEND_CHAR);
+    obj->data[obj->length++] = ch;
+    obj->data[obj->length] = '\0';
+    return obj;
 }
 
 wide_string_builder_t * append_wide_char(wide_string_builder_t *obj, wchar_t ch)
 {
     if (!obj)
     {
-        obj = instantiate_wide_string_builder(initial_capacity);
+        obj = instantiate_wide_string_builder(initial_capacity, STRING_STATS_APPEND_CHAR);
         obj->data[0] = ch;
         obj->data[1] = L'\0';
         obj->length = 1;
         return obj;
     }
-    else if (obj->capacity > obj->length)
-    {
-        obj->data[obj->length++] = ch;
-        obj->data[obj->length] = L'\0';
-        return obj;
-    }
-    else
-    {
-        size_t new_capacity = obj->capacity ? obj->capacity * 2 : initial_capacity;
-        wide_string_builder_t *new_obj = instantiate_wide_string_builder(new_capacity);
-        new_obj->length = obj->length + 1;
-        memcpy(new_obj->data, obj->data, obj->length * sizeof(wchar_t));
-        new_obj->data[obj->length] = ch;
-        new_obj->data[new_obj->length] = L'\0';
-        free(obj);
-        return new_obj;
-    }
+    if (obj->capacity == obj->length)
+        obj = resize_wide_string_builder(obj, get_new_capacity(obj->capacity, obj->length + 1), STRING_STATS_APPEND_CHAR);
+    obj->data[obj->length++] = ch;
+    obj->data[obj->length] = L'\0';
+    return obj;
 }
 
 string_builder_t * append_string(string_builder_t *obj, string_t str)
@@ -109,32 +196,19 @@ string_builder_t * append_string(string_builder_t *obj, string_t str)
     {
         size_t capacity = initial_capacity;
         if (capacity < str.length) capacity = str.length;
-        obj = instantiate_string_builder(capacity);
+        obj = instantiate_string_builder(capacity, STRING_STATS_APPEND_STRING);
         memcpy(obj->data, str.data, str.length * sizeof(char));
         obj->data[str.length] = '\0';
         obj->length = str.length;
         return obj;
     }
     size_t new_length = obj->length + str.length;
-    if (new_length <= obj->capacity)
-    {
-        memcpy(obj->data + obj->length, str.data, str.length * sizeof(char));
-        obj->data[new_length] = '\0';
-        obj->length = new_length;
-        return obj;
-    }
-    else
-    {
-        size_t new_capacity = obj->capacity ? obj->capacity * 2 : initial_capacity;
-        if (new_capacity < new_length) new_capacity = new_length;
-        string_builder_t *new_obj = instantiate_string_builder(new_capacity);
-        new_obj->length = new_length;
-        memcpy(new_obj->data, obj->data, obj->length * sizeof(char));
-        memcpy(new_obj->data + obj->length, str.data, str.length * sizeof(char));
-        new_obj->data[new_obj->length] = '\0';
-        free(obj);
-        return new_obj;
-    }    
+    if (new_length > obj->capacity)
+        obj = resize_string_builder(obj, get_new_capacity(obj->capacity, new_length), STRING_STATS_APPEND_STRING);
+    memcpy(obj->data + obj->length, str.data, str.length * sizeof(char));
+    obj->data[new_length] = '\0';
+    obj->length = new_length;
+    return obj;
 }
 
 wide_string_builder_t * append_non_wide_string(wide_string_builder_t *obj, string_t str)
@@ -143,44 +217,20 @@ wide_string_builder_t * append_non_wide_string(wide_string_builder_t *obj, strin
     {
         size_t capacity = initial_capacity;
         if (capacity < str.length) capacity = str.length;
-        obj = instantiate_wide_string_builder(capacity);
-        wchar_t *dst = obj->data;
-        char *src = str.data;
-        size_t k = str.length;
-        while(k--)
-            *dst++ = *src++;
-        *dst = L'\0';
-        obj->length = str.length;
-        return obj;
+        obj = instantiate_wide_string_builder(capacity, STRING_STATS_APPEND_STRING);
+        obj->length = 0;
     }
     size_t new_length = obj->length + str.length;
-    if (new_length <= obj->capacity)
-    {
-        wchar_t *dst = obj->data + obj->length;
-        char *src = str.data;
-        size_t k = str.length;
-        while(k--)
-            *dst++ = *src++;
-        *dst = L'\0';
-        obj->length = new_length;
-        return obj;
-    }
-    else
-    {
-        size_t new_capacity = obj->capacity ? obj->capacity * 2 : initial_capacity;
-        if (new_capacity < new_length) new_capacity = new_length;
-        wide_string_builder_t *new_obj = instantiate_wide_string_builder(new_capacity);
-        new_obj->length = new_length;
-        memcpy(new_obj->data, obj->data, obj->length * sizeof(wchar_t));
-        wchar_t *dst = new_obj->data + obj->length;
-        char *src = str.data;
-        size_t k = str.length;
-        while(k--)
-            *dst++ = *src++;
-        *dst = L'\0';
-        free(obj);
-        return new_obj;
-    }    
+    if (new_length > obj->capacity)
+        obj = resize_wide_string_builder(obj, get_new_capacity(obj->capacity, new_length), STRING_STATS_APPEND_STRING);
+    wchar_t *dst = obj->data + obj->length;
+    char *src = str.data;
+    size_t k = str.length;
+    while(k--)
+        *dst++ = *src++;
+    *dst = L'\0';
+    obj->length = new_length;
+    return obj;
 }
 
 wide_string_builder_t * append_wide_string(wide_string_builder_t *obj, wide_string_t str)
@@ -189,365 +239,1848 @@ wide_string_builder_t * append_wide_string(wide_string_builder_t *obj, wide_stri
     {
         size_t capacity = initial_capacity;
         if (capacity < str.length) capacity = str.length;
-        obj = instantiate_wide_string_builder(capacity);
+        obj = instantiate_wide_string_builder(capacity, STRING_STATS_APPEND_STRING);
         memcpy(obj->data, str.data, str.length * sizeof(wchar_t));
         obj->data[str.length] = L'\0';
         obj->length = str.length;
         return obj;
     }
     size_t new_length = obj->length + str.length;
-    if (new_length <= obj->capacity)
+    if (new_length > obj->capacity)
+        obj = resize_wide_string_builder(obj, get_new_capacity(obj->capacity, new_length), STRING_STATS_APPEND_STRING);
+    memcpy(obj->data + obj->length, str.data, str.length * sizeof(wchar_t));
+    obj->data[new_length] = L'\0';
+    obj->length = new_length;
+    return obj;
+}
+
+#define MAX_FORMAT_PRECISION 100
+#define MAX_NUMBER_TEXT_LENGTH (DBL_MAX_10_EXP + MAX_FORMAT_PRECISION + 4)
+
+typedef enum
+{
+    FORMAT_LITERAL,
+    FORMAT_CHAR,
+    FORMAT_C_STRING,
+    FORMAT_STRING,
+    FORMAT_WIDE_C_STRING,
+    FORMAT_WIDE_STRING,
+    FORMAT_SIGNED,
+    FORMAT_UNSIGNED,
+    FORMAT_FIXED,
+    FORMAT_SHORTEST,
+    FORMAT_RESET
+} format_item_type_t;
+
+typedef enum
+{
+    ARGUMENT_INT,
+    ARGUMENT_LONG,
+    ARGUMENT_LONG_LONG,
+    ARGUMENT_SIZE
+} format_argument_size_t;
+
+typedef struct
+{
+    format_item_type_t type;
+    format_argument_size_t size;
+    int precision;
+    size_t offset;
+    size_t length;
+} format_item_t;
+
+struct string_format_t
+{
+    format_item_t *items;
+    size_t count;
+    size_t literal_length;
+    char *text;
+};
+
+static __inline wchar_t get_format_char(const void *format, bool wide, size_t index)
+{
+    return wide ? ((const wchar_t*)format)[index] : (wchar_t)(unsigned char)((const char*)format)[index];
+}
+
+static size_t parse_format_item(const void *format, bool wide, format_item_t *item)
+{
+    size_t i = 0;
+    wchar_t ch = get_format_char(format, wide, i);
+    item->size = ARGUMENT_INT;
+    item->precision = -1;
+    item->offset = 0;
+    item->length = 0;
+    if (ch == '.')
     {
-        memcpy(obj->data + obj->length, str.data, str.length * sizeof(wchar_t));
-        obj->data[new_length] = L'\0';
-        obj->length = new_length;
-        return obj;
+        int precision = 0;
+        ch = get_format_char(format, wide, ++i);
+        while (ch >= '0' && ch <= '9')
+        {
+            if (precision < MAX_FORMAT_PRECISION)
+                precision = precision * 10 + (int)(ch - '0');
+            ch = get_format_char(format, wide, ++i);
+        }
+        item->precision = precision < MAX_FORMAT_PRECISION ? precision : MAX_FORMAT_PRECISION;
     }
-    else
+    if (ch == 'l')
     {
-        size_t new_capacity = obj->capacity ? obj->capacity * 2 : initial_capacity;
-        if (new_capacity < new_length) new_capacity = new_length;
-        wide_string_builder_t *new_obj = instantiate_wide_string_builder(new_capacity);
-        new_obj->length = new_length;
-        memcpy(new_obj->data, obj->data, obj->length * sizeof(wchar_t));
-        memcpy(new_obj->data + obj->length, str.data, str.length * sizeof(wchar_t));
-        new_obj->data[new_obj->length] = L'\0';
-        free(obj);
-        return new_obj;
-    }    
+        item->size = ARGUMENT_LONG;
+        ch = get_format_char(format, wide, ++i);
+        if (ch == 'l')
+        {
+            item->size = ARGUMENT_LONG_LONG;
+            ch = get_format_char(format, wide, ++i);
+        }
+    }
+    else if (ch == 'z')
+    {
+        item->size = ARGUMENT_SIZE;
+        ch = get_format_char(format, wide, ++i);
+    }
+    switch(ch)
+    {
+        case 'c':
+            item->type = FORMAT_CHAR;
+            break;
+        case 's':
+            item->type = FORMAT_C_STRING;
+            break;
+        case 'S':
+            item->type = FORMAT_STRING;
+            break;
+        case 'w':
+            item->type = wide ? FORMAT_WIDE_C_STRING : FORMAT_LITERAL;
+            break;
+        case 'W':
+            item->type = wide ? FORMAT_WIDE_STRING : FORMAT_LITERAL;
+            break;
+        case 'i':
+        case 'd':
+            item->type = FORMAT_SIGNED;
+            break;
+        case 'u':
+            item->type = FORMAT_UNSIGNED;
+            break;
+        case 'f':
+            item->type = FORMAT_FIXED;
+            break;
+        case 'g':
+            item->type = FORMAT_SHORTEST;
+            break;
+        case 0:
+            if (i)
+            {
+                item->type = FORMAT_LITERAL;
+                break;
+            }
+            item->type = FORMAT_RESET;
+            return i;
+        default:
+            item->type = FORMAT_LITERAL;
+            break;
+    }
+    if (item->size != ARGUMENT_INT && item->type != FORMAT_SIGNED && item->type != FORMAT_UNSIGNED)
+        item->type = FORMAT_LITERAL;
+    if (item->precision >= 0 && item->type != FORMAT_FIXED)
+        item->type = FORMAT_LITERAL;
+    if (item->type == FORMAT_LITERAL)
+    {
+        /*
+            A size prefix applies only to integers and a precision only to '%f',
+            '%g' is always the shortest round-trip form; an invalid item emits
+            the character after '%' and the rest is parsed as plain text
+        */
+        item->length = 1;
+        return 1;
+    }
+    return i + 1;
 }
 
-string_builder_t * append_formatted_string_ext(string_builder_t *obj, const char *format, va_list arg_list)
+static size_t format_number(char *buffer, const format_item_t *item, va_list *args)
 {
-    const char *ptr = format;
-    while(*ptr)
+    switch(item->type)
     {
-        if (*ptr == '%')
-        {
-            ptr++;
-            switch(*ptr)
+        case FORMAT_SIGNED:
+            switch(item->size)
             {
-                case 'c':
-                {
-                    int ch = va_arg(arg_list, int);
-                    obj = append_char(obj, (char)ch);
-                    break;
-                }
+                case ARGUMENT_LONG:
+                    return format_int64(buffer, va_arg(*args, long));
+                case ARGUMENT_LONG_LONG:
+                    return format_int64(buffer, va_arg(*args, long long));
+                case ARGUMENT_SIZE:
+                    return format_int64(buffer, va_arg(*args, ptrdiff_t));
+                default:
+                    return format_int64(buffer, va_arg(*args, int));
+            }
 
-                case 's':
-                {
-                    const char *c_str = va_arg(arg_list, const char*);
-                    obj = append_string(obj, _S(c_str));
-                    break;
-                }
+        case FORMAT_UNSIGNED:
+            switch(item->size)
+            {
+                case ARGUMENT_LONG:
+                    return format_uint64(buffer, va_arg(*args, unsigned long));
+                case ARGUMENT_LONG_LONG:
+                    return format_uint64(buffer, va_arg(*args, unsigned long long));
+                case ARGUMENT_SIZE:
+                    return format_uint64(buffer, va_arg(*args, size_t));
+                default:
+                    return format_uint64(buffer, va_arg(*args, unsigned int));
+            }
 
-                case 'S':
-                {
-                    string_t str = va_arg(arg_list, string_t);
-                    obj = append_string(obj, str);
-                    break;
-                }
+        case FORMAT_FIXED:
+        {
+            double value = va_arg(*args, double);
+            int precision = item->precision < 0 ? 6 : item->precision;
+            int length = snprintf(buffer, MAX_NUMBER_TEXT_LENGTH, "%.*f", precision, value);
+            return length > 0 ? (size_t)length : 0;
+        }
 
-                case 'i':
-                case 'd':
-                {
-                    int value = va_arg(arg_list, int);
-                    char tmp[11];
-                    sprintf(tmp, "%d", value);
-                    obj = append_string(obj, _S(tmp));
-                    break;
-                }
+        default:
+            return format_double_shortest(buffer, va_arg(*args, double));
+    }
+}
 
-                case 'f':
-                {
-                    double value = va_arg(arg_list, double);
-                    char tmp[11];
-                    sprintf(tmp, "%f", value);
-                    obj = append_string(obj, _S(tmp));
-                    break;
-                }
+static string_builder_t * append_format_argument(string_builder_t *obj, const format_item_t *item, va_list *args)
+{
+    switch(item->type)
+    {
+        case FORMAT_CHAR:
+        {
+            int ch = va_arg(*args, int);
+            return append_char(obj, (char)ch);
+        }
 
-                default:
-                    obj = append_char(obj, *ptr);
-                    break;
-                    
-                case 0:
-                    obj->data[0] = '\0';
-                    obj->length = 0;
-                    return obj;
-            }
-            ptr++;
+        case FORMAT_C_STRING:
+        {
+            const char *c_str = va_arg(*args, const char*);
+            return append_string(obj, _S(c_str));
         }
-        else
+
+        case FORMAT_STRING:
         {
-            obj = append_char(obj, *ptr);
-            ptr++;
+            string_t str = va_arg(*args, string_t);
+            return append_string(obj, str);
+        }
+
+        case FORMAT_RESET:
+            if (!obj)
+                return create_string_builder(0);
+            obj->data[0] = '\0';
+            obj->length = 0;
+            return obj;
+
+        default:
+        {
+            char tmp[MAX_NUMBER_TEXT_LENGTH];
+            size_t length = format_number(tmp, item, args);
+            return append_string(obj, init_string(tmp, length));
         }
     }
-    return obj;
 }
 
-wide_string_builder_t * append_formatted_wide_string_ext(wide_string_builder_t *obj, const wchar_t *format, va_list arg_list)
+static wide_string_builder_t * append_wide_format_argument(wide_string_builder_t *obj, const format_item_t *item, va_list *args)
 {
-    const wchar_t *ptr = format;
-    while(*ptr)
+    switch(item->type)
     {
-        if (*ptr == '%')
+        case FORMAT_CHAR:
         {
-            ptr++;
-            switch(*ptr)
-            {
-                case 'c':
-                {
-                    int ch = va_arg(arg_list, int);
-                    obj = append_wide_char(obj, (wchar_t)ch);
-                    break;
-                }
-
-                case 's':
-                {
-                    const char *c_str = va_arg(arg_list, const char*);
-                    obj = append_non_wide_string(obj, _S(c_str));
-                    break;
-                }
+            int ch = va_arg(*args, int);
+            return append_wide_char(obj, (wchar_t)ch);
+        }
 
-                case 'S':
-                {
-                    string_t str = va_arg(arg_list, string_t);
-                    obj = append_non_wide_string(obj, str);
-                    break;
-                }
+        case FORMAT_C_STRING:
+        {
+            const char *c_str = va_arg(*args, const char*);
+            return append_non_wide_string(obj, _S(c_str));
+        }
 
-                case 'w':
-                {
-                    const wchar_t *c_wstr = va_arg(arg_list, const wchar_t*);
-                    obj = append_wide_string(obj, _W(c_wstr));
-                    break;
-                }
+        case FORMAT_STRING:
+        {
+            string_t str = va_arg(*args, string_t);
+            return append_non_wide_string(obj, str);
+        }
 
-                case 'W':
-                {
-                    wide_string_t wstr = va_arg(arg_list, wide_string_t);
-                    obj = append_wide_string(obj, wstr);
-                    break;
-                }
+        case FORMAT_WIDE_C_STRING:
+        {
+            const wchar_t *c_wstr = va_arg(*args, const wchar_t*);
+            return append_wide_string(obj, _W(c_wstr));
+        }
 
-                case 'i':
-                case 'd':
-                {
-                    int value = va_arg(arg_list, int);
-                    char tmp[11];
-                    sprintf(tmp, "%d", value);
-                    obj = append_non_wide_string(obj, _S(tmp));
-                    break;
-                }
+        case FORMAT_WIDE_STRING:
+        {
+            wide_string_t wstr = va_arg(*args, wide_string_t);
+            return append_wide_string(obj, wstr);
+        }
 
-                case 'f':
-                {
-                    double value = va_arg(arg_list, double);
-                    char tmp[11];
-                    sprintf(tmp, "%f", value);
-                    obj = append_non_wide_string(obj, _S(tmp));
-                    break;
-                }
+        case FORMAT_RESET:
+            if (!obj)
+                return create_wide_string_builder(0);
+            obj->data[0] = L'\0';
+            obj->length = 0;
+            return obj;
 
-                default:
-                    obj = append_wide_char(obj, *ptr);
-                    break;
-                    
-                case 0:
-                    obj->data[0] = '\0';
-                    obj->length = 0;
-                    return obj;
-            }
-            ptr++;
-        }
-        else
+        default:
         {
-            obj = append_wide_char(obj, *ptr);
-            ptr++;
+            char tmp[MAX_NUMBER_TEXT_LENGTH];
+            size_t length = format_number(tmp, item, args);
+            return append_non_wide_string(obj, init_string(tmp, length));
         }
     }
-    return obj;
 }
 
-int compare_strings(string_t *first, string_t *second)
+string_builder_t * append_formatted_string_ext(string_builder_t *obj, const char *format, va_list arg_list)
 {
-    return strcmp(first->data, second->data);
+    STATS_ENTER(STRING_STATS_FORMAT);
+    va_list args;
+    va_copy(args, arg_list);
+    const char *ptr = format;
+    while(*ptr)
+    {
+        const char *run = ptr;
+        while (*ptr && *ptr != '%')
+            ptr++;
+        if (ptr > run)
+            obj = append_string(obj, init_string(run, ptr - run));
+        if (!*ptr)
+            break;
+        ptr++;
+        format_item_t item;
+        size_t consumed = parse_format_item(ptr, false, &item);
+        if (item.type == FORMAT_LITERAL)
+            obj = append_char(obj, ptr[item.offset]);
+        else
+            obj = append_format_argument(obj, &item, &args);
+        if (item.type == FORMAT_RESET)
+            break;
+        ptr += consumed;
+    }
+    va_end(args);
+    STATS_LEAVE();
+    return obj;
 }
 
-int compare_wide_strings(wide_string_t *first, wide_string_t *second)
+wide_string_builder_t * append_formatted_wide_string_ext(wide_string_builder_t *obj, const wchar_t *format, va_list arg_list)
 {
-    return wcscmp(first->data, second->data);
+    STATS_ENTER(STRING_STATS_FORMAT);
+    va_list args;
+    va_copy(args, arg_list);
+    const wchar_t *ptr = format;
+    while(*ptr)
+    {
+        const wchar_t *run = ptr;
+        while (*ptr && *ptr != L'%')
+            ptr++;
+        if (ptr > run)
+            obj = append_wide_string(obj, init_wide_string(run, ptr - run));
+        if (!*ptr)
+            break;
+        ptr++;
+        format_item_t item;
+        size_t consumed = parse_format_item(ptr, true, &item);
+        if (item.type == FORMAT_LITERAL)
+            obj = append_wide_char(obj, ptr[item.offset]);
+        else
+            obj = append_wide_format_argument(obj, &item, &args);
+        if (item.type == FORMAT_RESET)
+            break;
+        ptr += consumed;
+    }
+    va_end(args);
+    STATS_LEAVE();
+    return obj;
 }
 
-string_t * duplicate_string(string_t str)
+string_t * create_formatted_string_ext(const char *format, va_list arg_list)
 {
-    string_t *copy = nnalloc(sizeof(string_t) + (str.length + 1) * sizeof(char));
-    copy->data = (char*)(copy + 1);
-    copy->length = str.length;
-    memcpy(copy->data, str.data, str.length * sizeof(char));
-    copy->data[str.length] = '\0';
-    return copy;
+    string_builder_t *b = append_formatted_string_ext(NULL, format, arg_list);
+    if (b)
+        STATS_WASTE(STRING_STATS_FORMAT, (b->capacity - b->length) * sizeof(char));
+    return (string_t*)b;
 }
 
-wide_string_t * duplicate_wide_string(wide_string_t str)
+wide_string_t * create_formatted_wide_string_ext(const wchar_t *format, va_list arg_list)
 {
-    wide_string_t *copy = nnalloc(sizeof(string_t) + (str.length + 1) * sizeof(wchar_t));
-    copy->data = (wchar_t*)(copy + 1);
-    copy->length = str.length;
-    memcpy(copy->data, str.data, str.length * sizeof(wchar_t));
-    copy->data[str.length] = L'\0';
-    return copy;    
+    wide_string_builder_t *b = append_formatted_wide_string_ext(NULL, format, arg_list);
+    if (b)
+        STATS_WASTE(STRING_STATS_FORMAT, (b->capacity - b->length) * sizeof(wchar_t));
+    return (wide_string_t*)b;
 }
 
-wide_string_t *decode_utf8_string(string_t str)
+string_format_t * compile_format(const char *format)
 {
-    size_t i = 0;
-    wide_string_builder_t *b = NULL;
-    while (i < str.length)
+    size_t text_length = strlen(format);
+    size_t count = 0;
+    const char *ptr = format;
+    while(*ptr)
     {
-        unsigned char c0 = (unsigned char)str.data[i];
-        wchar_t w = 0;
-        if ((c0 & 0x80) == 0)
-        {
-            w = c0;
-            i++;
-        }
-        else if ((c0 & 0xE0) == 0xC0)
-        {
-            if (i + 1 >= str.length)
-                goto error;
-            unsigned char c1 = (unsigned char)str.data[i + 1];
-            if ((c1 & 0xC0) != 0x80)
-                goto error;
-            w = ((c0 & 0x1F) << 6) + (c1 & 0x3F);
-            i += 2;
-        }
-        else if ((c0 & 0xF0) == 0xE0)
+        if (*ptr != '%')
         {
-            if (i + 2 >= str.length)
-                goto error;
-            unsigned char c1 = (unsigned char)str.data[i + 1];
-            unsigned char c2 = (unsigned char)str.data[i + 2];
-            if ((c1 & 0xC0) != 0x80 || (c2 & 0xC0) != 0x80)
-                goto error;
-            w = ((c0 & 0xF) << 12) + ((c1 & 0x3F) << 6) + (c2 & 0x3F);
-            i += 3;
+            while (*ptr && *ptr != '%')
+                ptr++;
+            count++;
+            continue;
         }
-#if WCHAR_MAX > 0xFFFF
-        else if ((c0 & 0xF8) == 0xF0)
+        format_item_t item;
+        ptr += 1 + parse_format_item(ptr + 1, false, &item);
+        count++;
+        if (item.type == FORMAT_RESET)
+            break;
+    }
+    size_t size = sizeof(string_format_t) + sizeof(format_item_t) * count + text_length + 1;
+    string_format_t *obj = nnalloc(size);
+    STATS_ALLOCATION(STRING_STATS_COMPILE_FORMAT, size);
+    obj->items = (format_item_t*)(obj + 1);
+    obj->text = (char*)(obj->items + count);
+    memcpy(obj->text, format, text_length + 1);
+    obj->count = 0;
+    obj->literal_length = 0;
+    ptr = obj->text;
+    while (*ptr)
+    {
+        format_item_t *item = &obj->items[obj->count++];
+        if (*ptr != '%')
         {
-            if (i + 3 >= str.length)
-                goto error;
-            unsigned char c1 = (unsigned char)str.data[i + 1];
-            unsigned char c2 = (unsigned char)str.data[i + 2];
-            unsigned char c3 = (unsigned char)str.data[i + 3];
-            if ((c1 & 0xC0) != 0x80 || (c2 & 0xC0) != 0x80 || (c3 & 0xC0) != 0x80)
-                goto error;
-            w = ((c0 & 0x7) << 18) + ((c1 & 0x3F) << 12) + ((c2 & 0x3F) << 6) + (c3 & 0x3F);
-            i += 4;
+            const char *run = ptr;
+            while (*ptr && *ptr != '%')
+                ptr++;
+            item->type = FORMAT_LITERAL;
+            item->offset = run - obj->text;
+            item->length = ptr - run;
         }
-#endif
         else
         {
-            goto error;
+            ptr++;
+            size_t consumed = parse_format_item(ptr, false, item);
+            item->offset += ptr - obj->text;
+            ptr += consumed;
+            if (item->type == FORMAT_RESET)
+                break;
         }
-        b = append_wide_char(b, w);
+        obj->literal_length += item->length;
     }
-    if (!b)
-        b = create_wide_string_builder(0);
-    return (wide_string_t*)b;
-
-error:
-    free(b);
-    return NULL;
+    return obj;
 }
 
-static int encode_utf8_char(wchar_t w, char *c)
+string_builder_t * append_compiled_format_ext(string_builder_t *obj, const string_format_t *format, va_list arg_list)
 {
-    if (w < 0x80)
+    STATS_ENTER(STRING_STATS_COMPILED_FORMAT);
+    va_list args;
+    va_copy(args, arg_list);
+    if (format->literal_length)
+        obj = reserve_string_builder(obj, (obj ? obj->length : 0) + format->literal_length);
+    for (size_t i = 0; i < format->count; i++)
     {
-        c[0] = (char)w;
+        const format_item_t *item = &format->items[i];
+        if (item->type == FORMAT_LITERAL)
+            obj = append_string(obj, init_string(format->text + item->offset, item->length));
+        else
+            obj = append_format_argument(obj, item, &args);
+    }
+    va_end(args);
+    STATS_LEAVE();
+    return obj;
+}
+
+static __inline uint64_t mix_hash(uint64_t a, uint64_t b)
+{
+    uint64_t high;
+    uint64_t low = multiply_64x64(a, b, &high);
+    return low ^ high;
+}
+
+static __inline uint64_t read_uint64(const char *data)
+{
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+uint64_t hash_string(string_t str)
+{
+    const uint64_t k0 = 0xA0761D6478BD642FULL;
+    const uint64_t k1 = 0xE7037ED1A0B428DBULL;
+    const uint64_t k2 = 0x8EBC6AF09C88C6E3ULL;
+    const char *data = str.data;
+    size_t rest = str.length;
+    uint64_t h = mix_hash((uint64_t)str.length ^ k0, k1);
+    while (rest > 16)
+    {
+        h = mix_hash(read_uint64(data) ^ k1, read_uint64(data + 8) ^ h);
+        data += 16;
+        rest -= 16;
+    }
+    char tail[16] = { 0 };
+    if (rest)
+        memcpy(tail, data, rest);
+    h = mix_hash(read_uint64(tail) ^ k1, read_uint64(tail + 8) ^ h);
+    return mix_hash(h ^ k2, (uint64_t)str.length ^ k1);
+}
+
+static __inline int compare_lengths(size_t first, size_t second)
+{
+    return first < second ? -1 : (first > second ? 1 : 0);
+}
+
+int compare_strings(string_t *first, string_t *second)
+{
+    size_t length = first->length < second->length ? first->length : second->length;
+    int result = length ? memcmp(first->data, second->data, length) : 0;
+    return result ? result : compare_lengths(first->length, second->length);
+}
+
+int compare_wide_strings(wide_string_t *first, wide_string_t *second)
+{
+    size_t length = first->length < second->length ? first->length : second->length;
+    int result = length ? wmemcmp(first->data, second->data, length) : 0;
+    return result ? result : compare_lengths(first->length, second->length);
+}
+
+static __inline unsigned char ascii_to_lower(unsigned char ch)
+{
+    return ch >= 'A' && ch <= 'Z' ? ch + ('a' - 'A') : ch;
+}
+
+#ifdef STRINGS_SSE2
+static __inline __m128i ascii_to_lower_16(__m128i v)
+{
+    __m128i is_upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+        _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+    return _mm_or_si128(v, _mm_and_si128(is_upper, _mm_set1_epi8(0x20)));
+}
+#endif
+
+static size_t mismatch_ignore_case(const char *first, const char *second, size_t length)
+{
+    size_t i = 0;
+#ifdef STRINGS_SSE2
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i a = ascii_to_lower_16(_mm_loadu_si128((const __m128i*)(first + i)));
+        __m128i b = ascii_to_lower_16(_mm_loadu_si128((const __m128i*)(second + i)));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) ^ 0xFFFF;
+        if (mask)
+            return i + count_trailing_zeros(mask);
+    }
+#endif
+    for (; i < length; i++)
+    {
+        if (ascii_to_lower((unsigned char)first[i]) != ascii_to_lower((unsigned char)second[i]))
+            break;
+    }
+    return i;
+}
+
+int compare_strings_ignore_case(string_t *first, string_t *second)
+{
+    size_t length = first->length < second->length ? first->length : second->length;
+    size_t index = mismatch_ignore_case(first->data, second->data, length);
+    if (index < length)
+        return (int)ascii_to_lower((unsigned char)first->data[index])
+            - (int)ascii_to_lower((unsigned char)second->data[index]);
+    return compare_lengths(first->length, second->length);
+}
+
+bool are_strings_equal_ignore_case(string_t first, string_t second)
+{
+    return first.length == second.length
+        && mismatch_ignore_case(first.data, second.data, first.length) == first.length;
+}
+
+static __inline bool is_digit(char ch)
+{
+    return ch >= '0' && ch <= '9';
+}
+
+int compare_strings_natural(string_t *first, string_t *second)
+{
+    const char *a = first->data,
+        *b = second->data;
+    size_t i = 0,
+        j = 0;
+    while (i < first->length && j < second->length)
+    {
+        if (is_digit(a[i]) && is_digit(b[j]))
+        {
+            while (i < first->length && a[i] == '0')
+                i++;
+            while (j < second->length && b[j] == '0')
+                j++;
+            size_t start_a = i,
+                start_b = j;
+            while (i < first->length && is_digit(a[i]))
+                i++;
+            while (j < second->length && is_digit(b[j]))
+                j++;
+            size_t digits_a = i - start_a,
+                digits_b = j - start_b;
+            if (digits_a != digits_b)
+                return compare_lengths(digits_a, digits_b);
+            int result = digits_a ? memcmp(a + start_a, b + start_b, digits_a) : 0;
+            if (result)
+                return result;
+        }
+        else
+        {
+            if (a[i] != b[j])
+                return (int)(unsigned char)a[i] - (int)(unsigned char)b[j];
+            i++;
+            j++;
+        }
+    }
+    int result = compare_lengths(first->length - i, second->length - j);
+    return result ? result : compare_strings(first, second);
+}
+
+string_t * duplicate_string(string_t str)
+{
+    size_t size = sizeof(string_t) + (str.length + 1) * sizeof(char);
+    string_t *copy = nnalloc(size);
+    STATS_ALLOCATION(STRING_STATS_DUPLICATE, size);
+    copy->data = (char*)(copy + 1);
+    copy->length = str.length;
+    memcpy(copy->data, str.data, str.length * sizeof(char));
+    copy->data[str.length] = '\0';
+    return copy;
+}
+
+wide_string_t * duplicate_wide_string(wide_string_t str)
+{
+    size_t size = sizeof(string_t) + (str.length + 1) * sizeof(wchar_t);
+    wide_string_t *copy = nnalloc(size);
+    STATS_ALLOCATION(STRING_STATS_DUPLICATE, size);
+    copy->data = (wchar_t*)(copy + 1);
+    copy->length = str.length;
+    memcpy(copy->data, str.data, str.length * sizeof(wchar_t));
+    copy->data[str.length] = L'\0';
+    return copy;    
+}
+
+static size_t ascii_prefix_length(const char *data, size_t length)
+{
+    size_t i = 0;
+#ifdef STRINGS_AVX2
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(v);
+        if (mask)
+            return i + count_trailing_zeros(mask);
+    }
+#endif
+#ifdef STRINGS_SSE2
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(v);
+        if (mask)
+            return i + count_trailing_zeros(mask);
+    }
+#else
+    for (; i + 8 <= length; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        if (word & 0x8080808080808080ULL)
+            break;
+    }
+#endif
+    while (i < length && (data[i] & 0x80) == 0)
+        i++;
+    return i;
+}
+
+static size_t widen_ascii_prefix(wchar_t *dst, const char *src, size_t length)
+{
+    size_t i = 0;
+#ifdef STRINGS_AVX2
+#if WCHAR_MAX > 0xFFFF
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        if (_mm256_movemask_epi8(v))
+            break;
+        __m128i lo = _mm256_castsi256_si128(v);
+        __m128i hi = _mm256_extracti128_si256(v, 1);
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_cvtepu8_epi32(lo));
+        _mm256_storeu_si256((__m256i*)(dst + i + 8), _mm256_cvtepu8_epi32(_mm_srli_si128(lo, 8)));
+        _mm256_storeu_si256((__m256i*)(dst + i + 16), _mm256_cvtepu8_epi32(hi));
+        _mm256_storeu_si256((__m256i*)(dst + i + 24), _mm256_cvtepu8_epi32(_mm_srli_si128(hi, 8)));
+    }
+#else
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        if (_mm256_movemask_epi8(v))
+            break;
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+        _mm256_storeu_si256((__m256i*)(dst + i + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)));
+    }
+#endif
+#endif
+#ifdef STRINGS_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        if (_mm_movemask_epi8(v))
+            break;
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+#if WCHAR_MAX > 0xFFFF
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128((__m128i*)(dst + i + 4), _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128((__m128i*)(dst + i + 8), _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128((__m128i*)(dst + i + 12), _mm_unpackhi_epi16(hi, zero));
+#else
+        _mm_storeu_si128((__m128i*)(dst + i), lo);
+        _mm_storeu_si128((__m128i*)(dst + i + 8), hi);
+#endif
+    }
+#endif
+    while (i < length && (src[i] & 0x80) == 0)
+    {
+        dst[i] = (wchar_t)src[i];
+        i++;
+    }
+    return i;
+}
+
+static __inline size_t decode_utf8_char(const unsigned char *c, size_t avail, wchar_t *w)
+{
+    unsigned char c0 = c[0];
+    if ((c0 & 0x80) == 0)
+    {
+        *w = c0;
         return 1;
     }
-    if (w < 0x800)
+    else if ((c0 & 0xE0) == 0xC0)
     {
-        c[0] = (char)((w & 0x7C0) >> 6) + 0xC0;
-        c[1] = (char)(w & 0x3F) + 0x80;
+        if (avail < 2 || (c[1] & 0xC0) != 0x80)
+            return 0;
+        *w = ((c0 & 0x1F) << 6) + (c[1] & 0x3F);
         return 2;
     }
-    if (w < 0x10000)
+    else if ((c0 & 0xF0) == 0xE0)
     {
-        c[0] = (char)((w & 0xF000) >> 12) + 0xE0;
-        c[1] = (char)((w & 0xFC0) >> 6) + 0x80;
-        c[2] = (char)(w & 0x3F) + 0x80;
+        if (avail < 3 || (c[1] & 0xC0) != 0x80 || (c[2] & 0xC0) != 0x80)
+            return 0;
+        *w = ((c0 & 0xF) << 12) + ((c[1] & 0x3F) << 6) + (c[2] & 0x3F);
         return 3;
     }
 #if WCHAR_MAX > 0xFFFF
-    if (w < 0x200000)
+    else if ((c0 & 0xF8) == 0xF0)
     {
-        c[0] = (char)((w & 0x1C0000) >> 18) + 0xF0;
-        c[1] = (char)((w & 0x3F000) >> 12) + 0x80;
-        c[2] = (char)((w & 0xFC0) >> 6) + 0x80;
-        c[3] = (char)(w & 0x3F) + 0x80;
-        return 3;
+        if (avail < 4 || (c[1] & 0xC0) != 0x80 || (c[2] & 0xC0) != 0x80 || (c[3] & 0xC0) != 0x80)
+            return 0;
+        *w = ((c0 & 0x7) << 18) + ((c[1] & 0x3F) << 12) + ((c[2] & 0x3F) << 6) + (c[3] & 0x3F);
+        return 4;
     }
 #endif
     return 0;
 }
 
-string_t * encode_utf8_string(wide_string_t wstr)
+#ifdef STRINGS_SSE2
+static __inline __m128i shift_in_bytes(__m128i v, __m128i prev, int count)
 {
-    string_builder_t *b = NULL;
-    int i, n;
-    char tmp[4];
-    for (size_t k = 0; k < wstr.length; k++)
+    switch (count)
+    {
+        case 1:
+            return _mm_or_si128(_mm_slli_si128(v, 1), _mm_srli_si128(prev, 15));
+        case 2:
+            return _mm_or_si128(_mm_slli_si128(v, 2), _mm_srli_si128(prev, 14));
+        default:
+            return _mm_or_si128(_mm_slli_si128(v, 3), _mm_srli_si128(prev, 13));
+    }
+}
+
+static __inline __m128i unsigned_at_least(__m128i v, unsigned char bound)
+{
+    __m128i b = _mm_set1_epi8((char)bound);
+    return _mm_cmpeq_epi8(_mm_max_epu8(v, b), v);
+}
+
+static size_t scan_utf8_blocks(const unsigned char *data, size_t length, size_t *count, bool *valid)
+{
+#if WCHAR_MAX > 0xFFFF
+    const unsigned char first_invalid = 0xF8;
+#else
+    const unsigned char first_invalid = 0xF0;
+#endif
+    const __m128i cont_mask = _mm_set1_epi8((char)0xC0);
+    const __m128i cont_bits = _mm_set1_epi8((char)0x80);
+    __m128i prev = _mm_setzero_si128();
+    __m128i error = _mm_setzero_si128();
+    size_t i = 0,
+        n = 0;
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        if (!_mm_movemask_epi8(_mm_or_si128(v, prev)))
+        {
+            n += 16;
+            prev = v;
+            continue;
+        }
+        __m128i need = _mm_or_si128(
+            _mm_or_si128(unsigned_at_least(shift_in_bytes(v, prev, 1), 0xC0),
+                unsigned_at_least(shift_in_bytes(v, prev, 2), 0xE0)),
+            unsigned_at_least(shift_in_bytes(v, prev, 3), 0xF0));
+        __m128i is_cont = _mm_cmpeq_epi8(_mm_and_si128(v, cont_mask), cont_bits);
+        error = _mm_or_si128(error, _mm_xor_si128(need, is_cont));
+        error = _mm_or_si128(error, unsigned_at_least(v, first_invalid));
+        n += 16 - count_bits((unsigned int)_mm_movemask_epi8(is_cont));
+        prev = v;
+    }
+    *valid = _mm_movemask_epi8(error) == 0;
+    if (i >= 3)
+    {
+        if (data[i - 1] >= 0xC0)
+            i -= 1, n--;
+        else if (data[i - 2] >= 0xE0)
+            i -= 2, n--;
+        else if (data[i - 3] >= 0xF0)
+            i -= 3, n--;
+    }
+    *count = n;
+    return i;
+}
+#endif
+
+static bool scan_utf8_string(string_t str, size_t *count)
+{
+    const unsigned char *data = (const unsigned char*)str.data;
+    size_t i = 0,
+        n = 0;
+#ifdef STRINGS_SSE2
+    bool valid;
+    i = scan_utf8_blocks(data, str.length, &n, &valid);
+    if (!valid)
+        return false;
+#endif
+    while (i < str.length)
+    {
+        if ((data[i] & 0x80) == 0)
+        {
+            size_t run = ascii_prefix_length(str.data + i, str.length - i);
+            i += run;
+            n += run;
+            continue;
+        }
+        wchar_t w;
+        size_t width = decode_utf8_char(data + i, str.length - i, &w);
+        if (!width)
+            return false;
+        i += width;
+        n++;
+    }
+    *count = n;
+    return true;
+}
+
+wide_string_t *decode_utf8_string(string_t str)
+{
+    size_t count;
+    if (!scan_utf8_string(str, &count))
+        return NULL;
+    wide_string_builder_t *b = instantiate_wide_string_builder(count, STRING_STATS_DECODE_UTF8);
+    const unsigned char *data = (const unsigned char*)str.data;
+    wchar_t *dst = b->data;
+    size_t i = 0;
+    while (i < str.length)
+    {
+        if ((data[i] & 0x80) == 0)
+        {
+            size_t run = widen_ascii_prefix(dst, str.data + i, str.length - i);
+            i += run;
+            dst += run;
+            continue;
+        }
+        i += decode_utf8_char(data + i, str.length - i, dst++);
+    }
+    *dst = L'\0';
+    b->length = count;
+    return (wide_string_t*)b;
+}
+
+static __inline size_t get_utf8_sequence_length(unsigned char c0)
+{
+    if ((c0 & 0x80) == 0)
+        return 1;
+    if ((c0 & 0xE0) == 0xC0)
+        return 2;
+    if ((c0 & 0xF0) == 0xE0)
+        return 3;
+#if WCHAR_MAX > 0xFFFF
+    if ((c0 & 0xF8) == 0xF0)
+        return 4;
+#endif
+    return 0;
+}
+
+static __inline bool are_continuation_bytes(const unsigned char *c, size_t count)
+{
+    for (size_t k = 0; k < count; k++)
+    {
+        if ((c[k] & 0xC0) != 0x80)
+            return false;
+    }
+    return true;
+}
+
+/*
+    Decodes as many characters as fit into 'capacity', returns the number
+    of bytes consumed; a sequence cut at the end of the chunk is stored
+    in the decoder and counts as consumed
+*/
+static size_t run_utf8_decoder(utf8_decoder_t *decoder, const unsigned char *data, size_t length,
+    wchar_t *dst, size_t capacity, size_t *written)
+{
+    size_t i = 0,
+        n = 0;
+    *written = 0;
+    if (decoder->error_offset != SIZE_MAX || !capacity)
+        return 0;
+    if (decoder->pending_length)
+    {
+        size_t need = get_utf8_sequence_length(decoder->pending[0]);
+        size_t take = need - decoder->pending_length;
+        if (take > length)
+            take = length;
+        if (!are_continuation_bytes(data, take))
+        {
+            decoder->error_offset = decoder->offset - decoder->pending_length;
+            return 0;
+        }
+        memcpy(decoder->pending + decoder->pending_length, data, take);
+        decoder->pending_length += (unsigned int)take;
+        i = take;
+        if (decoder->pending_length < need)
+        {
+            decoder->offset += i;
+            return i;
+        }
+        decode_utf8_char(decoder->pending, need, dst);
+        decoder->pending_length = 0;
+        n = 1;
+    }
+    while (i < length && n < capacity)
+    {
+        if ((data[i] & 0x80) == 0)
+        {
+            size_t limit = length - i < capacity - n ? length - i : capacity - n;
+            size_t run = widen_ascii_prefix(dst + n, (const char*)data + i, limit);
+            i += run;
+            n += run;
+            continue;
+        }
+        size_t width = decode_utf8_char(data + i, length - i, dst + n);
+        if (width)
+        {
+            i += width;
+            n++;
+            continue;
+        }
+        size_t need = get_utf8_sequence_length(data[i]);
+        if (need > length - i && are_continuation_bytes(data + i + 1, length - i - 1))
+        {
+            memcpy(decoder->pending, data + i, length - i);
+            decoder->pending_length = (unsigned int)(length - i);
+            i = length;
+            break;
+        }
+        decoder->error_offset = decoder->offset + i;
+        break;
+    }
+    decoder->offset += i;
+    *written = n;
+    return i;
+}
+
+wide_string_builder_t * feed_utf8_decoder(utf8_decoder_t *decoder, wide_string_builder_t *obj, string_t chunk)
+{
+    size_t length = obj ? obj->length : 0;
+    obj = reserve_wide_string_builder(obj, length + chunk.length);
+    size_t written;
+    run_utf8_decoder(decoder, (const unsigned char*)chunk.data, chunk.length,
+        obj->data + length, chunk.length, &written);
+    obj->length = length + written;
+    obj->data[obj->length] = L'\0';
+    return obj;
+}
+
+size_t feed_utf8_decoder_to_buffer(utf8_decoder_t *decoder, string_t chunk, wchar_t *buffer, size_t buffer_size,
+    size_t *written)
+{
+    return run_utf8_decoder(decoder, (const unsigned char*)chunk.data, chunk.length, buffer, buffer_size, written);
+}
+
+bool finish_utf8_decoder(utf8_decoder_t *decoder)
+{
+    if (decoder->error_offset == SIZE_MAX && decoder->pending_length)
+        decoder->error_offset = decoder->offset - decoder->pending_length;
+    decoder->pending_length = 0;
+    return decoder->error_offset == SIZE_MAX;
+}
+
+bool utf8_validate(string_t str)
+{
+    size_t count;
+    return scan_utf8_string(str, &count);
+}
+
+static __inline bool is_utf8_lead_byte(unsigned char c)
+{
+    return (c & 0xC0) != 0x80;
+}
+
+/*
+    Every byte that is not a continuation byte starts a code point;
+    continuation bytes are the only ones below 0xC0 as signed values
+*/
+size_t utf8_count_code_points(string_t str)
+{
+    const unsigned char *data = (const unsigned char*)str.data;
+    size_t i = 0,
+        count = 0;
+#ifdef STRINGS_SSE2
+    const __m128i bound = _mm_set1_epi8((char)0xC0);
+    const __m128i zero = _mm_setzero_si128();
+    while (i + 16 <= str.length)
+    {
+        __m128i acc = _mm_setzero_si128();
+        for (int k = 0; k < 255 && i + 16 <= str.length; k++, i += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+            acc = _mm_sub_epi8(acc, _mm_cmplt_epi8(v, bound));
+        }
+        __m128i sums = _mm_sad_epu8(acc, zero);
+        count += (size_t)_mm_cvtsi128_si32(sums) + (size_t)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+    }
+    count = i - count;
+#endif
+    for (; i < str.length; i++)
+    {
+        if (is_utf8_lead_byte(data[i]))
+            count++;
+    }
+    return count;
+}
+
+size_t utf8_offset_of_code_point(string_t str, size_t index)
+{
+    const unsigned char *data = (const unsigned char*)str.data;
+    size_t i = 0;
+#ifdef STRINGS_SSE2
+    const __m128i bound = _mm_set1_epi8((char)0xC0);
+    for (; i + 16 <= str.length; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        unsigned int leads = ~(unsigned int)_mm_movemask_epi8(_mm_cmplt_epi8(v, bound)) & 0xFFFF;
+        size_t count = count_bits(leads);
+        if (index < count)
+        {
+            while (index--)
+                leads &= leads - 1;
+            return i + count_trailing_zeros(leads);
+        }
+        index -= count;
+    }
+#endif
+    for (; i < str.length; i++)
+    {
+        if (is_utf8_lead_byte(data[i]))
+        {
+            if (!index)
+                return i;
+            index--;
+        }
+    }
+    return str.length;
+}
+
+string_t * utf8_sub_string(string_t str, size_t index, size_t length)
+{
+    size_t begin = utf8_offset_of_code_point(str, index);
+    string_t tail = init_string(str.data + begin, str.length - begin);
+    return sub_string(str, begin, utf8_offset_of_code_point(tail, length));
+}
+
+static int encode_utf8_char(wchar_t w, char *c)
+{
+    if (w < 0x80)
+    {
+        c[0] = (char)w;
+        return 1;
+    }
+    if (w < 0x800)
+    {
+        c[0] = (char)((w & 0x7C0) >> 6) + 0xC0;
+        c[1] = (char)(w & 0x3F) + 0x80;
+        return 2;
+    }
+    if (w < 0x10000)
+    {
+        c[0] = (char)((w & 0xF000) >> 12) + 0xE0;
+        c[1] = (char)((w & 0xFC0) >> 6) + 0x80;
+        c[2] = (char)(w & 0x3F) + 0x80;
+        return 3;
+    }
+#if WCHAR_MAX > 0xFFFF
+    if (w < 0x200000)
+    {
+        c[0] = (char)((w & 0x1C0000) >> 18) + 0xF0;
+        c[1] = (char)((w & 0x3F000) >> 12) + 0x80;
+        c[2] = (char)((w & 0xFC0) >> 6) + 0x80;
+        c[3] = (char)(w & 0x3F) + 0x80;
+        return 4;
+    }
+#endif
+    return 0;
+}
+
+static __inline size_t get_utf8_char_length(wchar_t w)
+{
+    if (w < 0x80)
+        return 1;
+    if (w < 0x800)
+        return 2;
+    if (w < 0x10000)
+        return 3;
+#if WCHAR_MAX > 0xFFFF
+    if (w < 0x200000)
+        return 4;
+#endif
+    return 1;
+}
+
+size_t calculate_utf8_length(wide_string_t wstr)
+{
+    const wchar_t *data = wstr.data;
+    size_t i = 0,
+        length = wstr.length;
+#if defined(STRINGS_SSE2) && WCHAR_MAX > 0xFFFF
+    const __m128i bound_2 = _mm_set1_epi32(0x7F);
+    const __m128i bound_3 = _mm_set1_epi32(0x7FF);
+    const __m128i bound_4 = _mm_set1_epi32(0xFFFF);
+    const __m128i bound_bad = _mm_set1_epi32(0x1FFFFF);
+    while (i + 4 <= wstr.length)
+    {
+        size_t block_end = i + ((size_t)1 << 28);
+        if (block_end > wstr.length) block_end = wstr.length;
+        __m128i extra = _mm_setzero_si128();
+        for (; i + 4 <= block_end; i += 4)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+            __m128i bad = _mm_cmpgt_epi32(v, bound_bad);
+            extra = _mm_sub_epi32(extra, _mm_cmpgt_epi32(v, bound_2));
+            extra = _mm_sub_epi32(extra, _mm_cmpgt_epi32(v, bound_3));
+            extra = _mm_sub_epi32(extra, _mm_cmpgt_epi32(v, bound_4));
+            extra = _mm_add_epi32(extra, _mm_add_epi32(bad, _mm_add_epi32(bad, bad)));
+        }
+        uint32_t lanes[4];
+        _mm_storeu_si128((__m128i*)lanes, extra);
+        length += (size_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+#elif defined(STRINGS_SSE2)
+    const __m128i bias = _mm_set1_epi16((short)0x8000);
+    const __m128i bound_2 = _mm_set1_epi16((short)(0x7F ^ 0x8000));
+    const __m128i bound_3 = _mm_set1_epi16((short)(0x7FF ^ 0x8000));
+    while (i + 8 <= wstr.length)
+    {
+        size_t block_end = i + ((size_t)1 << 16);
+        if (block_end > wstr.length) block_end = wstr.length;
+        __m128i extra = _mm_setzero_si128();
+        for (; i + 8 <= block_end; i += 8)
+        {
+            __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(data + i)), bias);
+            extra = _mm_sub_epi16(extra, _mm_cmpgt_epi16(v, bound_2));
+            extra = _mm_sub_epi16(extra, _mm_cmpgt_epi16(v, bound_3));
+        }
+        uint16_t lanes[8];
+        _mm_storeu_si128((__m128i*)lanes, extra);
+        for (int k = 0; k < 8; k++)
+            length += lanes[k];
+    }
+#endif
+    for (; i < wstr.length; i++)
+        length += get_utf8_char_length(data[i]) - 1;
+    return length;
+}
+
+static size_t narrow_ascii_prefix(char *dst, const wchar_t *src, size_t length)
+{
+    size_t i = 0;
+#if defined(STRINGS_SSE2) && WCHAR_MAX > 0xFFFF
+    const __m128i not_ascii = _mm_set1_epi32(~0x7F);
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + i + 4));
+        __m128i c = _mm_loadu_si128((const __m128i*)(src + i + 8));
+        __m128i d = _mm_loadu_si128((const __m128i*)(src + i + 12));
+        __m128i all = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(all, not_ascii), zero)) != 0xFFFF)
+            break;
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+        _mm_storeu_si128((__m128i*)(dst + i), packed);
+    }
+#elif defined(STRINGS_SSE2)
+    const __m128i not_ascii = _mm_set1_epi16(~0x7F);
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + i + 8));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(_mm_or_si128(a, b), not_ascii), zero)) != 0xFFFF)
+            break;
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(a, b));
+    }
+#endif
+    while (i < length && src[i] >= 0 && src[i] < 0x80)
+    {
+        dst[i] = (char)src[i];
+        i++;
+    }
+    return i;
+}
+
+static char * encode_utf8_chars(char *dst, const wchar_t *src, size_t count)
+{
+    size_t i = 0;
+    while (i < count)
+    {
+        if (src[i] >= 0 && src[i] < 0x80)
+        {
+            size_t run = narrow_ascii_prefix(dst, src + i, count - i);
+            i += run;
+            dst += run;
+            continue;
+        }
+        int n = encode_utf8_char(src[i++], dst);
+        if (n > 0)
+            dst += n;
+        else
+            *dst++ = '?';
+    }
+    return dst;
+}
+
+string_t * encode_utf8_string(wide_string_t wstr)
+{
+    size_t length = calculate_utf8_length(wstr);
+    string_builder_t *b = instantiate_string_builder(length, STRING_STATS_ENCODE_UTF8);
+    encode_utf8_chars(b->data, wstr.data, wstr.length);
+    b->data[length] = '\0';
+    b->length = length;
+    return (string_t*)b;
+}
+
+size_t encode_utf8_string_to_buffer(wide_string_t wstr, char *buffer, size_t buffer_size)
+{
+    size_t length = calculate_utf8_length(wstr);
+    if (!buffer_size)
+        return length;
+    if (length < buffer_size)
+    {
+        encode_utf8_chars(buffer, wstr.data, wstr.length);
+        buffer[length] = '\0';
+        return length;
+    }
+    char *dst = buffer;
+    char *end = buffer + buffer_size - 1;
+    for (size_t k = 0; k < wstr.length; k++)
+    {
+        char tmp[4];
+        int n = encode_utf8_char(wstr.data[k], tmp);
+        if (n <= 0)
+        {
+            tmp[0] = '?';
+            n = 1;
+        }
+        if (end - dst < n)
+            break;
+        memcpy(dst, tmp, n);
+        dst += n;
+    }
+    *dst = '\0';
+    return length;
+}
+
+typedef enum
+{
+    CASE_LOWER,
+    CASE_UPPER,
+    CASE_FOLD
+} case_mapping_t;
+
+static __inline const unicode_properties_t * get_unicode_properties(uint32_t cp)
+{
+    if (cp >= UNICODE_TABLES_LIMIT)
+        return &unicode_properties[0];
+    size_t block = unicode_blocks[cp >> UNICODE_BLOCK_SHIFT];
+    return &unicode_properties[unicode_block_items[(block << UNICODE_BLOCK_SHIFT)
+        | (cp & ((1 << UNICODE_BLOCK_SHIFT) - 1))]];
+}
+
+static __inline int32_t get_case_delta(uint32_t cp, case_mapping_t mapping)
+{
+    const unicode_properties_t *properties = get_unicode_properties(cp);
+    return mapping == CASE_UPPER ? properties->upper : (mapping == CASE_LOWER ? properties->lower : properties->fold);
+}
+
+static __inline char ascii_change_case(char ch, case_mapping_t mapping)
+{
+    if (mapping == CASE_UPPER)
+        return ch >= 'a' && ch <= 'z' ? ch - ('a' - 'A') : ch;
+    return ch >= 'A' && ch <= 'Z' ? ch + ('a' - 'A') : ch;
+}
+
+#ifdef STRINGS_SSE2
+static __inline __m128i ascii_to_upper_16(__m128i v)
+{
+    __m128i is_lower = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('a' - 1)),
+        _mm_cmplt_epi8(v, _mm_set1_epi8('z' + 1)));
+    return _mm_xor_si128(v, _mm_and_si128(is_lower, _mm_set1_epi8(0x20)));
+}
+
+static __inline __m128i ascii_change_case_16(__m128i v, case_mapping_t mapping)
+{
+    return mapping == CASE_UPPER ? ascii_to_upper_16(v) : ascii_to_lower_16(v);
+}
+#endif
+
+static __inline uint64_t ascii_change_case_8(uint64_t word, case_mapping_t mapping)
+{
+    const uint64_t ones = 0x0101010101010101ULL;
+    char first = mapping == CASE_UPPER ? 'a' : 'A',
+        last = mapping == CASE_UPPER ? 'z' : 'Z';
+    uint64_t heptets = word & (0x7F * ones);
+    uint64_t above_first = heptets + (0x80 - first) * ones;
+    uint64_t above_last = heptets + (0x7F - last) * ones;
+    uint64_t letters = ~word & (above_first ^ above_last) & (0x80 * ones);
+    return word ^ (letters >> 2);
+}
+
+/*
+    Bytes outside ASCII are left as they are, so 'dst' may be equal to 'src';
+    the tail shorter than a block is handled by converting the last
+    block once more, which is harmless since the conversion is idempotent;
+    8 to 15 bytes, the length of typical header names, are converted
+    by words as well, which measured faster than a byte loop there
+*/
+static void change_ascii_case(char *dst, const char *src, size_t length, case_mapping_t mapping)
+{
+    size_t i = 0;
+#ifdef STRINGS_SSE2
+    if (length >= 16)
+    {
+        for (; i + 16 <= length; i += 16)
+            _mm_storeu_si128((__m128i*)(dst + i),
+                ascii_change_case_16(_mm_loadu_si128((const __m128i*)(src + i)), mapping));
+        if (i < length)
+            _mm_storeu_si128((__m128i*)(dst + length - 16),
+                ascii_change_case_16(_mm_loadu_si128((const __m128i*)(src + length - 16)), mapping));
+        return;
+    }
+#endif
+    if (length >= 8)
+    {
+        uint64_t word;
+        for (; i + 8 <= length; i += 8)
+        {
+            memcpy(&word, src + i, sizeof(word));
+            word = ascii_change_case_8(word, mapping);
+            memcpy(dst + i, &word, sizeof(word));
+        }
+        if (i < length)
+        {
+            memcpy(&word, src + length - 8, sizeof(word));
+            word = ascii_change_case_8(word, mapping);
+            memcpy(dst + length - 8, &word, sizeof(word));
+        }
+        return;
+    }
+    for (; i < length; i++)
+        dst[i] = ascii_change_case(src[i], mapping);
+}
+
+/*
+    Converts UTF-8 text, or only calculates the length of the result
+    if 'dst' is NULL; invalid and overlong sequences are copied unchanged
+*/
+static size_t change_utf8_case(char *dst, const char *src, size_t length, case_mapping_t mapping)
+{
+    size_t i = 0,
+        j = 0;
+    while (i < length)
+    {
+#ifdef STRINGS_SSE2
+        if (i + 16 <= length)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+            unsigned int mask = (unsigned int)_mm_movemask_epi8(v);
+            if (!mask)
+            {
+                if (dst)
+                    _mm_storeu_si128((__m128i*)(dst + j), ascii_change_case_16(v, mapping));
+                i += 16;
+                j += 16;
+                continue;
+            }
+            size_t ascii = count_trailing_zeros(mask);
+            if (dst)
+            {
+                for (size_t k = 0; k < ascii; k++)
+                    dst[j + k] = ascii_change_case(src[i + k], mapping);
+            }
+            i += ascii;
+            j += ascii;
+        }
+#endif
+        if ((src[i] & 0x80) == 0)
+        {
+            if (dst)
+                dst[j] = ascii_change_case(src[i], mapping);
+            i++;
+            j++;
+            continue;
+        }
+        wchar_t w;
+        size_t n = decode_utf8_char((const unsigned char*)src + i, length - i, &w);
+        int32_t delta = 0;
+        if (!n)
+            n = 1;
+        else if (get_utf8_char_length(w) == n)
+            delta = get_case_delta((uint32_t)w, mapping);
+        if (delta)
+        {
+            char tmp[4];
+            j += encode_utf8_char((wchar_t)(w + delta), dst ? dst + j : tmp);
+        }
+        else
+        {
+            if (dst)
+                memcpy(dst + j, src + i, n);
+            j += n;
+        }
+        i += n;
+    }
+    return j;
+}
+
+static string_t * change_string_case(string_t str, case_mapping_t mapping)
+{
+    size_t prefix = ascii_prefix_length(str.data, str.length);
+    size_t length = prefix + (prefix < str.length
+        ? change_utf8_case(NULL, str.data + prefix, str.length - prefix, mapping) : 0);
+    string_builder_t *b = instantiate_string_builder(length, STRING_STATS_CHANGE_CASE);
+    change_ascii_case(b->data, str.data, prefix, mapping);
+    change_utf8_case(b->data + prefix, str.data + prefix, str.length - prefix, mapping);
+    b->data[length] = '\0';
+    b->length = length;
+    return (string_t*)b;
+}
+
+string_t * string_to_lower_case(string_t str)
+{
+    return change_string_case(str, CASE_LOWER);
+}
+
+string_t * string_to_upper_case(string_t str)
+{
+    return change_string_case(str, CASE_UPPER);
+}
+
+string_t * fold_string_case(string_t str)
+{
+    return change_string_case(str, CASE_FOLD);
+}
+
+void string_to_lower_case_in_place(string_t str)
+{
+    change_ascii_case(str.data, str.data, str.length, CASE_LOWER);
+}
+
+void string_to_upper_case_in_place(string_t str)
+{
+    change_ascii_case(str.data, str.data, str.length, CASE_UPPER);
+}
+
+void fold_string_case_in_place(string_t str)
+{
+    change_ascii_case(str.data, str.data, str.length, CASE_FOLD);
+}
+
+static __inline wchar_t change_wide_char_case(wchar_t ch, case_mapping_t mapping)
+{
+    if ((uint32_t)ch < 0x80)
+        return (wchar_t)ascii_change_case((char)ch, mapping);
+    return (wchar_t)(ch + get_case_delta((uint32_t)ch, mapping));
+}
+
+#ifdef STRINGS_SSE2
+static __inline bool change_wide_ascii_case_16(__m128i v, case_mapping_t mapping, __m128i *result)
+{
+    __m128i letters;
+#if WCHAR_MAX > 0xFFFF
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(v, _mm_set1_epi32(~0x7F)), _mm_setzero_si128())) != 0xFFFF)
+        return false;
+    letters = _mm_and_si128(_mm_cmpgt_epi32(v, _mm_set1_epi32(mapping == CASE_UPPER ? 'a' - 1 : 'A' - 1)),
+        _mm_cmplt_epi32(v, _mm_set1_epi32(mapping == CASE_UPPER ? 'z' + 1 : 'Z' + 1)));
+    letters = _mm_and_si128(letters, _mm_set1_epi32(0x20));
+#else
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16(~0x7F)), _mm_setzero_si128())) != 0xFFFF)
+        return false;
+    letters = _mm_and_si128(_mm_cmpgt_epi16(v, _mm_set1_epi16(mapping == CASE_UPPER ? 'a' - 1 : 'A' - 1)),
+        _mm_cmplt_epi16(v, _mm_set1_epi16(mapping == CASE_UPPER ? 'z' + 1 : 'Z' + 1)));
+    letters = _mm_and_si128(letters, _mm_set1_epi16(0x20));
+#endif
+    *result = _mm_xor_si128(v, letters);
+    return true;
+}
+#endif
+
+static void change_wide_case(wchar_t *dst, const wchar_t *src, size_t length, case_mapping_t mapping)
+{
+    size_t i = 0;
+#ifdef STRINGS_SSE2
+    const size_t lanes = 16 / sizeof(wchar_t);
+    while (i + lanes <= length)
+    {
+        __m128i result;
+        if (change_wide_ascii_case_16(_mm_loadu_si128((const __m128i*)(src + i)), mapping, &result))
+        {
+            _mm_storeu_si128((__m128i*)(dst + i), result);
+            i += lanes;
+        }
+        else
+        {
+            for (size_t end = i + lanes; i < end; i++)
+                dst[i] = change_wide_char_case(src[i], mapping);
+        }
+    }
+#endif
+    for (; i < length; i++)
+        dst[i] = change_wide_char_case(src[i], mapping);
+}
+
+static wide_string_t * change_wide_string_case(wide_string_t wstr, case_mapping_t mapping)
+{
+    wide_string_builder_t *b = instantiate_wide_string_builder(wstr.length, STRING_STATS_CHANGE_CASE);
+    change_wide_case(b->data, wstr.data, wstr.length, mapping);
+    b->data[wstr.length] = L'\0';
+    b->length = wstr.length;
+    return (wide_string_t*)b;
+}
+
+wide_string_t * wide_string_to_lower_case(wide_string_t wstr)
+{
+    return change_wide_string_case(wstr, CASE_LOWER);
+}
+
+wide_string_t * wide_string_to_upper_case(wide_string_t wstr)
+{
+    return change_wide_string_case(wstr, CASE_UPPER);
+}
+
+wide_string_t * fold_wide_string_case(wide_string_t wstr)
+{
+    return change_wide_string_case(wstr, CASE_FOLD);
+}
+
+void wide_string_to_lower_case_in_place(wide_string_t wstr)
+{
+    change_wide_case(wstr.data, wstr.data, wstr.length, CASE_LOWER);
+}
+
+void wide_string_to_upper_case_in_place(wide_string_t wstr)
+{
+    change_wide_case(wstr.data, wstr.data, wstr.length, CASE_UPPER);
+}
+
+void fold_wide_string_case_in_place(wide_string_t wstr)
+{
+    change_wide_case(wstr.data, wstr.data, wstr.length, CASE_FOLD);
+}
+
+static __inline bool is_ascii_white_space(char ch)
+{
+    return ch == ' ' || (ch >= '\t' && ch <= '\r');
+}
+
+#ifdef STRINGS_SSE2
+static __inline unsigned int ascii_white_space_mask_16(__m128i v)
+{
+    __m128i controls = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('\t' - 1)),
+        _mm_cmplt_epi8(v, _mm_set1_epi8('\r' + 1)));
+    return (unsigned int)_mm_movemask_epi8(_mm_or_si128(controls, _mm_cmpeq_epi8(v, _mm_set1_epi8(' '))));
+}
+#endif
+
+static size_t skip_ascii_white_space(const char *data, size_t length)
+{
+    size_t i = 0;
+#ifdef STRINGS_SSE2
+    for (; i + 16 <= length; i += 16)
+    {
+        unsigned int mask = ascii_white_space_mask_16(_mm_loadu_si128((const __m128i*)(data + i))) ^ 0xFFFF;
+        if (mask)
+            return i + count_trailing_zeros(mask);
+    }
+#endif
+    while (i < length && is_ascii_white_space(data[i]))
+        i++;
+    return i;
+}
+
+static size_t skip_ascii_white_space_backward(const char *data, size_t end)
+{
+#ifdef STRINGS_SSE2
+    for (; end >= 16; end -= 16)
+    {
+        unsigned int mask = ascii_white_space_mask_16(_mm_loadu_si128((const __m128i*)(data + end - 16))) ^ 0xFFFF;
+        if (mask)
+            return end - 15 + highest_bit_index(mask);
+    }
+#endif
+    while (end > 0 && is_ascii_white_space(data[end - 1]))
+        end--;
+    return end;
+}
+
+static __inline bool is_utf8_white_space(const char *data, size_t length)
+{
+    wchar_t w = 0;
+    return decode_utf8_char((const unsigned char*)data, length, &w) == length && get_utf8_char_length(w) == length
+        && get_unicode_properties((uint32_t)w)->white_space;
+}
+
+string_t trim_string_left(string_t str)
+{
+    size_t i = 0;
+    for (;;)
+    {
+        i += skip_ascii_white_space(str.data + i, str.length - i);
+        if (i == str.length || (str.data[i] & 0x80) == 0)
+            break;
+        size_t n = get_utf8_sequence_length((unsigned char)str.data[i]);
+        if (!n || n > str.length - i || !is_utf8_white_space(str.data + i, n))
+            break;
+        i += n;
+    }
+    return init_string(str.data + i, str.length - i);
+}
+
+string_t trim_string_right(string_t str)
+{
+    size_t end = str.length;
+    for (;;)
+    {
+        end = skip_ascii_white_space_backward(str.data, end);
+        if (!end || (str.data[end - 1] & 0x80) == 0)
+            break;
+        size_t start = end - 1;
+        while (start > 0 && end - start < 4 && (str.data[start] & 0xC0) == 0x80)
+            start--;
+        if (!is_utf8_white_space(str.data + start, end - start))
+            break;
+        end = start;
+    }
+    return init_string(str.data, end);
+}
+
+string_t trim_string(string_t str)
+{
+    return trim_string_right(trim_string_left(str));
+}
+
+static __inline bool is_wide_white_space(wchar_t ch)
+{
+    if ((uint32_t)ch < 0x80)
+        return is_ascii_white_space((char)ch);
+    return get_unicode_properties((uint32_t)ch)->white_space != 0;
+}
+
+wide_string_t trim_wide_string_left(wide_string_t wstr)
+{
+    size_t i = 0;
+    while (i < wstr.length && is_wide_white_space(wstr.data[i]))
+        i++;
+    return init_wide_string(wstr.data + i, wstr.length - i);
+}
+
+wide_string_t trim_wide_string_right(wide_string_t wstr)
+{
+    size_t end = wstr.length;
+    while (end > 0 && is_wide_white_space(wstr.data[end - 1]))
+        end--;
+    return init_wide_string(wstr.data, end);
+}
+
+wide_string_t trim_wide_string(wide_string_t wstr)
+{
+    return trim_wide_string_right(trim_wide_string_left(wstr));
+}
+
+string_t * read_file_to_string(const char *file_name)
+{
+    FILE *stream = fopen(file_name, "rb");
+    if (!stream)
+        return NULL;
+    fseek(stream, 0, SEEK_END);
+    long file_size = ftell(stream);
+    const size_t max_size = SIZE_MAX - (sizeof(string_t) - 1);
+    if (file_size > max_size) file_size = max_size;
+    size_t length = (size_t)file_size;
+    string_t *str = nnalloc(sizeof(string_t) + length + 1);
+    STATS_ALLOCATION(STRING_STATS_READ_FILE, sizeof(string_t) + length + 1);
+    str->data = (char*)(str + 1);
+    str->length = length;
+    str->data[length] = 0;
+    rewind(stream);
+    size_t count = fread(str->data, 1, length, stream);
+    fclose(stream);
+    if (count < length)
+    {
+        free(str);
+        return  NULL;
+    }
+    return str;
+}
+
+typedef struct
+{
+    string_t str;
+    void *mapping;
+    size_t mapping_size;
+    string_builder_t *buffer;
+} mapped_file_t;
+
+static string_builder_t * read_stream_to_builder(FILE *stream)
+{
+    string_builder_t *b = create_string_builder(4096);
+    char chunk[65536];
+    size_t count;
+    while ((count = fread(chunk, 1, sizeof(chunk), stream)) > 0)
+        b = append_string(b, init_string(chunk, count));
+    if (ferror(stream))
+    {
+        free(b);
+        return NULL;
+    }
+    return b;
+}
+
+static string_t * wrap_stream(mapped_file_t *obj, FILE *stream)
+{
+    STATS_ENTER(STRING_STATS_MAP_FILE);
+    string_builder_t *b = stream ? read_stream_to_builder(stream) : NULL;
+    STATS_LEAVE();
+    if (stream)
+        fclose(stream);
+    if (!b)
+    {
+        free(obj);
+        return NULL;
+    }
+    STATS_WASTE(STRING_STATS_MAP_FILE, b->capacity - b->length);
+    obj->buffer = b;
+    obj->str = init_string(b->data, b->length);
+    return &obj->str;
+}
+
+#ifdef _WIN32
+string_t * map_file_to_string(const char *file_name)
+{
+    HANDLE file = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+    mapped_file_t *obj = nnalloc(sizeof(mapped_file_t));
+    STATS_ALLOCATION(STRING_STATS_MAP_FILE, sizeof(mapped_file_t));
+    obj->mapping = NULL;
+    obj->mapping_size = 0;
+    obj->buffer = NULL;
+    LARGE_INTEGER size;
+    if (GetFileType(file) == FILE_TYPE_DISK && GetFileSizeEx(file, &size)
+        && size.QuadPart > 0 && (unsigned long long)size.QuadPart <= SIZE_MAX)
+    {
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        void *view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+        if (mapping)
+            CloseHandle(mapping);
+        if (view)
+        {
+            CloseHandle(file);
+            obj->mapping = view;
+            obj->mapping_size = (size_t)size.QuadPart;
+            obj->str = init_string(view, obj->mapping_size);
+            return &obj->str;
+        }
+    }
+    CloseHandle(file);
+    return wrap_stream(obj, fopen(file_name, "rb"));
+}
+#else
+string_t * map_file_to_string(const char *file_name)
+{
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    mapped_file_t *obj = nnalloc(sizeof(mapped_file_t));
+    STATS_ALLOCATION(STRING_STATS_MAP_FILE, sizeof(mapped_file_t));
+    obj->mapping = NULL;
+    obj->mapping_size = 0;
+    obj->buffer = NULL;
+    if (S_ISREG(info.st_mode) && info.st_size > 0 && (uint64_t)info.st_size <= SIZE_MAX)
     {
-        wchar_t w = wstr.data[k];
-        n = encode_utf8_char(w, tmp);
-        if (n > 0)
+        size_t size = (size_t)info.st_size;
+        void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED)
         {
-            for (i = 0; i < n; i++)
-                b = append_char(b, tmp[i]);
+#ifdef MADV_SEQUENTIAL
+            madvise(mapping, size, MADV_SEQUENTIAL);
+#endif
+            close(fd);
+            obj->mapping = mapping;
+            obj->mapping_size = size;
+            obj->str = init_string(mapping, size);
+            return &obj->str;
         }
-        else
-            b = append_char(b, '?');
     }
-    if (!b)
-        b = create_string_builder(0);
-    return (string_t*)b;
+    FILE *stream = fdopen(fd, "rb");
+    if (!stream)
+        close(fd);
+    return wrap_stream(obj, stream);
 }
+#endif
 
-string_t * read_file_to_string(const char *file_name)
+void unmap_string(string_t *str)
 {
-    FILE *stream = fopen(file_name, "rb");
-    if (!stream)
-        return NULL;
-    fseek(stream, 0, SEEK_END);
-    long file_size = ftell(stream);
-    const size_t max_size = SIZE_MAX - (sizeof(string_t) - 1);
-    if (file_size > max_size) file_size = max_size;
-    size_t length = (size_t)file_size;
-    string_t *str = nnalloc(sizeof(string_t) + length + 1);
-    str->data = (char*)(str + 1);
-    str->length = length;
-    str->data[length] = 0;
-    rewind(stream);
-    size_t count = fread(str->data, 1, length, stream);
-    fclose(stream);
-    if (count < length)
+    mapped_file_t *obj = (mapped_file_t*)str;
+    if (obj->mapping)
     {
-        free(str);
-        return  NULL;
+#ifdef _WIN32
+        UnmapViewOfFile(obj->mapping);
+#else
+        munmap(obj->mapping, obj->mapping_size);
+#endif
     }
-    return str;
+    free(obj->buffer);
+    free(obj);
 }
 
 string_t * wide_string_to_string(wide_string_t wstr, char bad_char, bool *was_bad_char)
 {
     bool bad_flag = false;
     string_t * str = nnalloc(sizeof(string_t) + (wstr.length + 1) * sizeof(char));
+    STATS_ALLOCATION(STRING_STATS_WIDE_TO_NARROW, sizeof(string_t) + (wstr.length + 1) * sizeof(char));
     str->data = (char*)(str + 1);
     str->data[wstr.length] = '\0';
     str->length = wstr.length;
@@ -574,6 +2107,7 @@ string_t * sub_string(string_t str, size_t index, size_t length)
     size_t tail = str.length - index;
     if (length > tail) length = tail;
     string_t *result = nnalloc(sizeof(string_t) + (length + 1) * sizeof(char));
+    STATS_ALLOCATION(STRING_STATS_SUB_STRING, sizeof(string_t) + (length + 1) * sizeof(char));
     result->data = (char*)(result + 1);
     result->data[length] = '\0';
     memcpy(result->data, str.data + index, length * sizeof(char));
@@ -587,6 +2121,7 @@ wide_string_t * sub_wide_string(wide_string_t wstr, size_t index, size_t length)
     size_t tail = wstr.length - index;
     if (length > tail) length = tail;
     wide_string_t *result = nnalloc(sizeof(wide_string_t) + (length + 1) * sizeof(wchar_t));
+    STATS_ALLOCATION(STRING_STATS_SUB_STRING, sizeof(wide_string_t) + (length + 1) * sizeof(wchar_t));
     result->data = (wchar_t*)(result + 1);
     result->data[length] = L'\0';
     memcpy(result->data, wstr.data + index, length * sizeof(wchar_t));
@@ -596,10 +2131,34 @@ wide_string_t * sub_wide_string(wide_string_t wstr, size_t index, size_t length)
 
 size_t index_of_char_in_string(string_t str, char ch)
 {
+    const char *data = str.data;
     size_t i = 0;
+#ifdef STRINGS_AVX2
+    const __m256i pattern_256 = _mm256_set1_epi8(ch);
+    for (; i + 32 <= str.length; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, pattern_256));
+        if (mask)
+            return i + count_trailing_zeros(mask);
+    }
+#endif
+#ifdef STRINGS_SSE2
+    const __m128i pattern = _mm_set1_epi8(ch);
+    for (; i + 16 <= str.length; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, pattern));
+        if (mask)
+            return i + count_trailing_zeros(mask);
+    }
+#else
+    const char *found = memchr(data, ch, str.length);
+    return found ? (size_t)(found - data) : str.length;
+#endif
     for (; i < str.length; i++)
     {
-        if (str.data[i] == ch)
+        if (data[i] == ch)
             break;
     }
     return i;
@@ -607,19 +2166,531 @@ size_t index_of_char_in_string(string_t str, char ch)
 
 size_t index_of_char_in_wide_string(wide_string_t wstr, wchar_t ch)
 {
+    const wchar_t *data = wstr.data;
     size_t i = 0;
+#ifdef STRINGS_SSE2
+#if WCHAR_MAX > 0xFFFF
+    const __m128i pattern = _mm_set1_epi32((int)ch);
+    for (; i + 8 <= wstr.length; i += 8)
+    {
+        __m128i a = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(data + i)), pattern);
+        __m128i b = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(data + i + 4)), pattern);
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_packs_epi32(a, b));
+        if (mask)
+            return i + count_trailing_zeros(mask) / 2;
+    }
+#else
+    const __m128i pattern = _mm_set1_epi16((short)ch);
+    for (; i + 8 <= wstr.length; i += 8)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi16(v, pattern));
+        if (mask)
+            return i + count_trailing_zeros(mask) / 2;
+    }
+#endif
+#endif
     for (; i < wstr.length; i++)
     {
-        if (wstr.data[i] == ch)
+        if (data[i] == ch)
             break;
     }
     return i;
 }
 
+size_t last_index_of_char_in_string(string_t str, char ch)
+{
+    const char *data = str.data;
+    size_t i = str.length;
+#ifdef STRINGS_SSE2
+    const __m128i pattern = _mm_set1_epi8(ch);
+    for (; i >= 16; i -= 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i - 16));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, pattern));
+        if (mask)
+            return i - 16 + highest_bit_index(mask);
+    }
+#endif
+    while (i > 0)
+    {
+        if (data[--i] == ch)
+            return i;
+    }
+    return str.length;
+}
+
+size_t last_index_of_char_in_wide_string(wide_string_t wstr, wchar_t ch)
+{
+    const wchar_t *data = wstr.data;
+    size_t i = wstr.length;
+#ifdef STRINGS_SSE2
+#if WCHAR_MAX > 0xFFFF
+    const __m128i pattern = _mm_set1_epi32((int)ch);
+    for (; i >= 8; i -= 8)
+    {
+        __m128i a = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(data + i - 8)), pattern);
+        __m128i b = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(data + i - 4)), pattern);
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_packs_epi32(a, b));
+        if (mask)
+            return i - 8 + highest_bit_index(mask) / 2;
+    }
+#else
+    const __m128i pattern = _mm_set1_epi16((short)ch);
+    for (; i >= 8; i -= 8)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i - 8));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi16(v, pattern));
+        if (mask)
+            return i - 8 + highest_bit_index(mask) / 2;
+    }
+#endif
+#endif
+    while (i > 0)
+    {
+        if (data[--i] == ch)
+            return i;
+    }
+    return wstr.length;
+}
+
+size_t count_of_char_in_string(string_t str, char ch)
+{
+    const char *data = str.data;
+    size_t i = 0,
+        count = 0;
+#ifdef STRINGS_SSE2
+    const __m128i pattern = _mm_set1_epi8(ch);
+    const __m128i zero = _mm_setzero_si128();
+    while (i + 16 <= str.length)
+    {
+        __m128i acc = _mm_setzero_si128();
+        for (int k = 0; k < 255 && i + 16 <= str.length; k++, i += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, pattern));
+        }
+        __m128i sums = _mm_sad_epu8(acc, zero);
+        count += (size_t)_mm_cvtsi128_si32(sums) + (size_t)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+    }
+#endif
+    for (; i < str.length; i++)
+    {
+        if (data[i] == ch)
+            count++;
+    }
+    return count;
+}
+
+size_t count_of_char_in_wide_string(wide_string_t wstr, wchar_t ch)
+{
+    const wchar_t *data = wstr.data;
+    size_t i = 0,
+        count = 0;
+#ifdef STRINGS_SSE2
+#if WCHAR_MAX > 0xFFFF
+    const __m128i pattern = _mm_set1_epi32((int)ch);
+    for (; i + 8 <= wstr.length; i += 8)
+    {
+        __m128i a = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(data + i)), pattern);
+        __m128i b = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(data + i + 4)), pattern);
+        count += count_bits((unsigned int)_mm_movemask_epi8(_mm_packs_epi32(a, b))) / 2;
+    }
+#else
+    const __m128i pattern = _mm_set1_epi16((short)ch);
+    for (; i + 8 <= wstr.length; i += 8)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        count += count_bits((unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi16(v, pattern))) / 2;
+    }
+#endif
+#endif
+    for (; i < wstr.length; i++)
+    {
+        if (data[i] == ch)
+            count++;
+    }
+    return count;
+}
+
+typedef struct
+{
+    const unsigned char *needle;
+    size_t length;
+    ptrdiff_t critical_pos;
+    size_t period;
+    bool periodic;
+} two_way_searcher_t;
+
+static ptrdiff_t maximal_suffix(const unsigned char *x, size_t m, size_t *period, bool reversed)
+{
+    ptrdiff_t ms = -1;
+    size_t j = 0,
+        k = 1,
+        p = 1;
+    while (j + k < m)
+    {
+        unsigned char a = x[j + k];
+        unsigned char b = x[ms + (ptrdiff_t)k];
+        if (reversed ? a > b : a < b)
+        {
+            j += k;
+            k = 1;
+            p = j - ms;
+        }
+        else if (a == b)
+        {
+            if (k != p)
+                k++;
+            else
+            {
+                j += p;
+                k = 1;
+            }
+        }
+        else
+        {
+            ms = (ptrdiff_t)j;
+            j = ms + 1;
+            k = p = 1;
+        }
+    }
+    *period = p;
+    return ms;
+}
+
+static void init_two_way_searcher(two_way_searcher_t *tw, const unsigned char *needle, size_t length)
+{
+    size_t p, q;
+    ptrdiff_t i = maximal_suffix(needle, length, &p, false);
+    ptrdiff_t j = maximal_suffix(needle, length, &q, true);
+    tw->needle = needle;
+    tw->length = length;
+    if (i > j)
+    {
+        tw->critical_pos = i;
+        tw->period = p;
+    }
+    else
+    {
+        tw->critical_pos = j;
+        tw->period = q;
+    }
+    tw->periodic = tw->period + (size_t)(tw->critical_pos + 1) <= length
+        && 0 == memcmp(needle, needle + tw->period, (size_t)(tw->critical_pos + 1));
+    if (!tw->periodic)
+    {
+        size_t left = (size_t)(tw->critical_pos + 1);
+        size_t right = length - left;
+        tw->period = (left > right ? left : right) + 1;
+    }
+}
+
+static size_t two_way_search(const two_way_searcher_t *tw, const unsigned char *y, size_t n, size_t start, bool find_last)
+{
+    const unsigned char *x = tw->needle;
+    ptrdiff_t m = (ptrdiff_t)tw->length,
+        ell = tw->critical_pos,
+        per = (ptrdiff_t)tw->period,
+        last = -1,
+        i;
+    if ((size_t)m > n)
+        return SIZE_MAX;
+    ptrdiff_t j = (ptrdiff_t)start,
+        end = (ptrdiff_t)(n - m);
+    if (tw->periodic)
+    {
+        ptrdiff_t memory = -1;
+        while (j <= end)
+        {
+            i = (ell > memory ? ell : memory) + 1;
+            while (i < m && x[i] == y[i + j])
+                i++;
+            if (i >= m)
+            {
+                i = ell;
+                while (i > memory && x[i] == y[i + j])
+                    i--;
+                if (i <= memory)
+                {
+                    if (!find_last)
+                        return (size_t)j;
+                    last = j;
+                }
+                j += per;
+                memory = m - per - 1;
+            }
+            else
+            {
+                j += i - ell;
+                memory = -1;
+            }
+        }
+    }
+    else
+    {
+        while (j <= end)
+        {
+            i = ell + 1;
+            while (i < m && x[i] == y[i + j])
+                i++;
+            if (i >= m)
+            {
+                i = ell;
+                while (i >= 0 && x[i] == y[i + j])
+                    i--;
+                if (i < 0)
+                {
+                    if (!find_last)
+                        return (size_t)j;
+                    last = j;
+                }
+                j += per;
+            }
+            else
+            {
+                j += i - ell;
+            }
+        }
+    }
+    return last < 0 ? SIZE_MAX : (size_t)last;
+}
+
+static size_t find_substring(const two_way_searcher_t *tw, const unsigned char *y, size_t n, size_t start)
+{
+    size_t i = start;
+#ifdef STRINGS_SSE2
+    size_t m = tw->length;
+    const unsigned char *x = tw->needle;
+    const __m128i first = _mm_set1_epi8((char)x[0]);
+    const __m128i last = _mm_set1_epi8((char)x[m - 1]);
+    size_t work = 0;
+    for (; i + m - 1 + 16 <= n; i += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)(y + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(y + i + m - 1));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask)
+        {
+            size_t pos = i + count_trailing_zeros(mask);
+            if (m <= 2 || 0 == memcmp(y + pos + 1, x + 1, m - 2))
+                return pos;
+            mask &= mask - 1;
+            work += m;
+            if (work > 8 * m + 2 * (i - start))
+                return two_way_search(tw, y, n, pos + 1, false);
+        }
+    }
+#endif
+    return two_way_search(tw, y, n, i, false);
+}
+
+static size_t find_last_substring(const two_way_searcher_t *tw, const unsigned char *y, size_t n)
+{
+    size_t m = tw->length;
+    size_t i = n - m + 1;
+#ifdef STRINGS_SSE2
+    const unsigned char *x = tw->needle;
+    const __m128i first = _mm_set1_epi8((char)x[0]);
+    const __m128i last = _mm_set1_epi8((char)x[m - 1]);
+    size_t work = 0;
+    for (; i >= 16; i -= 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)(y + i - 16));
+        __m128i b = _mm_loadu_si128((const __m128i*)(y + i - 16 + m - 1));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask)
+        {
+            unsigned int bit = highest_bit_index(mask);
+            size_t pos = i - 16 + bit;
+            if (m <= 2 || 0 == memcmp(y + pos + 1, x + 1, m - 2))
+                return pos;
+            mask &= ~(1u << bit);
+            work += m;
+            if (work > 8 * m + 2 * (n - m + 1 - i))
+                return two_way_search(tw, y, pos + m - 1, 0, true);
+        }
+    }
+#endif
+    return two_way_search(tw, y, i + m - 1, 0, true);
+}
+
+size_t index_of_string(string_t haystack, string_t needle)
+{
+    if (needle.length == 0)
+        return 0;
+    if (needle.length == 1)
+        return index_of_char_in_string(haystack, needle.data[0]);
+    if (needle.length > haystack.length)
+        return haystack.length;
+    two_way_searcher_t tw;
+    init_two_way_searcher(&tw, (const unsigned char*)needle.data, needle.length);
+    size_t index = find_substring(&tw, (const unsigned char*)haystack.data, haystack.length, 0);
+    return index == SIZE_MAX ? haystack.length : index;
+}
+
+size_t last_index_of_string(string_t haystack, string_t needle)
+{
+    if (needle.length == 0)
+        return haystack.length;
+    if (needle.length == 1)
+        return last_index_of_char_in_string(haystack, needle.data[0]);
+    if (needle.length > haystack.length)
+        return haystack.length;
+    two_way_searcher_t tw;
+    init_two_way_searcher(&tw, (const unsigned char*)needle.data, needle.length);
+    size_t index = find_last_substring(&tw, (const unsigned char*)haystack.data, haystack.length);
+    return index == SIZE_MAX ? haystack.length : index;
+}
+
+size_t count_of_string(string_t haystack, string_t needle)
+{
+    if (needle.length == 0 || needle.length > haystack.length)
+        return 0;
+    if (needle.length == 1)
+        return count_of_char_in_string(haystack, needle.data[0]);
+    two_way_searcher_t tw;
+    init_two_way_searcher(&tw, (const unsigned char*)needle.data, needle.length);
+    size_t count = 0,
+        index = 0;
+    while ((index = find_substring(&tw, (const unsigned char*)haystack.data, haystack.length, index)) != SIZE_MAX)
+    {
+        count++;
+        index += needle.length;
+    }
+    return count;
+}
+
+static __inline size_t find_next_occurrence(const two_way_searcher_t *tw, string_t haystack, string_t needle, size_t start)
+{
+    if (needle.length == 1)
+    {
+        size_t index = start + index_of_char_in_string(
+            init_string(haystack.data + start, haystack.length - start), needle.data[0]);
+        return index == haystack.length ? SIZE_MAX : index;
+    }
+    if (start + needle.length > haystack.length)
+        return SIZE_MAX;
+    return find_substring(tw, (const unsigned char*)haystack.data, haystack.length, start);
+}
+
+/*
+    The output is reserved once: when the replacement is not longer than
+    the pattern the input length is enough, otherwise the occurrences
+    are counted first
+*/
+string_builder_t * replace_all(string_builder_t *obj, string_t str, string_t pattern, string_t replacement)
+{
+    size_t length = obj ? obj->length : 0;
+    if (pattern.length == 0 || pattern.length > str.length)
+        return append_string(obj, str);
+    size_t capacity = str.length;
+    if (replacement.length > pattern.length)
+        capacity += count_of_string(str, pattern) * (replacement.length - pattern.length);
+    obj = reserve_string_builder(obj, length + capacity);
+    two_way_searcher_t tw;
+    if (pattern.length > 1)
+        init_two_way_searcher(&tw, (const unsigned char*)pattern.data, pattern.length);
+    size_t start = 0,
+        index;
+    while ((index = find_next_occurrence(&tw, str, pattern, start)) != SIZE_MAX)
+    {
+        obj = append_string(obj, init_string(str.data + start, index - start));
+        obj = append_string(obj, replacement);
+        start = index + pattern.length;
+    }
+    return append_string(obj, init_string(str.data + start, str.length - start));
+}
+
+string_t * join_strings(strings_list_t *list, string_t separator)
+{
+    size_t length = list->size ? separator.length * (list->size - 1) : 0;
+    for (size_t i = 0; i < list->size; i++)
+        length += list->items[i]->length;
+    string_builder_t *b = instantiate_string_builder(length, STRING_STATS_JOIN);
+    char *dst = b->data;
+    for (size_t i = 0; i < list->size; i++)
+    {
+        if (i)
+        {
+            memcpy(dst, separator.data, separator.length * sizeof(char));
+            dst += separator.length;
+        }
+        memcpy(dst, list->items[i]->data, list->items[i]->length * sizeof(char));
+        dst += list->items[i]->length;
+    }
+    b->data[length] = '\0';
+    b->length = length;
+    return (string_t*)b;
+}
+
+wide_string_t * join_wide_strings(wide_strings_list_t *list, wide_string_t separator)
+{
+    size_t length = list->size ? separator.length * (list->size - 1) : 0;
+    for (size_t i = 0; i < list->size; i++)
+        length += list->items[i]->length;
+    wide_string_builder_t *b = instantiate_wide_string_builder(length, STRING_STATS_JOIN);
+    wchar_t *dst = b->data;
+    for (size_t i = 0; i < list->size; i++)
+    {
+        if (i)
+        {
+            memcpy(dst, separator.data, separator.length * sizeof(wchar_t));
+            dst += separator.length;
+        }
+        memcpy(dst, list->items[i]->data, list->items[i]->length * sizeof(wchar_t));
+        dst += list->items[i]->length;
+    }
+    b->data[length] = L'\0';
+    b->length = length;
+    return (wide_string_t*)b;
+}
+
+string_t * concat_string_array(const string_t *items, size_t count)
+{
+    size_t length = 0;
+    for (size_t i = 0; i < count; i++)
+        length += items[i].length;
+    string_builder_t *b = instantiate_string_builder(length, STRING_STATS_JOIN);
+    char *dst = b->data;
+    for (size_t i = 0; i < count; i++)
+    {
+        memcpy(dst, items[i].data, items[i].length * sizeof(char));
+        dst += items[i].length;
+    }
+    b->data[length] = '\0';
+    b->length = length;
+    return (string_t*)b;
+}
+
+string_t * concat_strings_ext(size_t count, va_list arg_list)
+{
+    va_list lengths;
+    va_copy(lengths, arg_list);
+    size_t length = 0;
+    for (size_t i = 0; i < count; i++)
+        length += va_arg(lengths, string_t).length;
+    va_end(lengths);
+    string_builder_t *b = instantiate_string_builder(length, STRING_STATS_JOIN);
+    char *dst = b->data;
+    for (size_t i = 0; i < count; i++)
+    {
+        string_t item = va_arg(arg_list, string_t);
+        memcpy(dst, item.data, item.length * sizeof(char));
+        dst += item.length;
+    }
+    b->data[length] = '\0';
+    b->length = length;
+    return (string_t*)b;
+}
+
 void destroy_strings_list(strings_list_t *list)
 {
     for (size_t i = 0; i < list->size; i++)
         free(list->items[i]);
+    free(list->items);
     free(list);
 }
 
@@ -633,7 +2704,9 @@ void destroy_wide_strings_list(wide_strings_list_t *list)
 
 strings_list_t * split_string(string_t str, char separator)
 {
+    STATS_ENTER(STRING_STATS_SPLIT);
     strings_list_t *list = nnalloc(sizeof(strings_list_t));
+    STATS_ALLOCATION(STRING_STATS_SPLIT, sizeof(strings_list_t));
     list->size = 0;
     if (str.length)
     {
@@ -644,6 +2717,7 @@ strings_list_t * split_string(string_t str, char separator)
                 count++;
         }
         list->items = nnalloc(sizeof(string_t*) * (count + 1));
+        STATS_ALLOCATION(STRING_STATS_SPLIT, sizeof(string_t*) * (count + 1));
         size_t idx = 0,
             length = 0;
         for (i = 0; i < str.length && count > 0; i++)
@@ -666,12 +2740,15 @@ strings_list_t * split_string(string_t str, char separator)
     {
         list->items = NULL;
     }
+    STATS_LEAVE();
     return list;
 }
 
 wide_strings_list_t * split_wide_string(wide_string_t wstr, wchar_t separator)
 {
+    STATS_ENTER(STRING_STATS_SPLIT);
     wide_strings_list_t *list = nnalloc(sizeof(wide_strings_list_t));
+    STATS_ALLOCATION(STRING_STATS_SPLIT, sizeof(wide_strings_list_t));
     list->size = 0;
     if (wstr.length)
     {
@@ -682,6 +2759,7 @@ wide_strings_list_t * split_wide_string(wide_string_t wstr, wchar_t separator)
                 count++;
         }
         list->items = nnalloc(sizeof(wide_string_t*) * (count + 1));
+        STATS_ALLOCATION(STRING_STATS_SPLIT, sizeof(wide_string_t*) * (count + 1));
         size_t idx = 0,
             length = 0;
         for (i = 0; i < wstr.length && count > 0; i++)
@@ -704,5 +2782,108 @@ wide_strings_list_t * split_wide_string(wide_string_t wstr, wchar_t separator)
     {
         list->items = NULL;
     }
+    STATS_LEAVE();
+    return list;
+}
+
+bool split_next(split_state_t *state, string_t *token)
+{
+    if (state->finished)
+        return false;
+    size_t index = index_of_char_in_string(state->rest, state->separator);
+    token->data = state->rest.data;
+    token->length = index;
+    if (index == state->rest.length)
+    {
+        state->finished = true;
+    }
+    else
+    {
+        state->rest.data += index + 1;
+        state->rest.length -= index + 1;
+    }
+    return true;
+}
+
+bool split_wide_next(wide_split_state_t *state, wide_string_t *token)
+{
+    if (state->finished)
+        return false;
+    size_t index = index_of_char_in_wide_string(state->rest, state->separator);
+    token->data = state->rest.data;
+    token->length = index;
+    if (index == state->rest.length)
+    {
+        state->finished = true;
+    }
+    else
+    {
+        state->rest.data += index + 1;
+        state->rest.length -= index + 1;
+    }
+    return true;
+}
+
+/*
+    Unlike splitting, a line feed terminates a line rather than separates
+    two of them, so there is no empty line after the final line feed
+*/
+bool next_line(line_state_t *state, string_t *line)
+{
+    if (!state->rest.length)
+        return false;
+    size_t index = index_of_char_in_string(state->rest, '\n');
+    size_t length = index;
+    if (length && state->rest.data[length - 1] == '\r')
+        length--;
+    *line = init_string(state->rest.data, length);
+    if (index < state->rest.length)
+        index++;
+    state->rest.data += index;
+    state->rest.length -= index;
+    return true;
+}
+
+string_views_list_t * split_string_to_views(string_t str, char separator)
+{
+    size_t count = 0;
+    if (str.length)
+    {
+        count = 1;
+        for (size_t i = 0; i < str.length; i++)
+        {
+            if(str.data[i] == separator)
+                count++;
+        }
+    }
+    string_views_list_t *list = nnalloc(sizeof(string_views_list_t) + sizeof(string_t) * count);
+    STATS_ALLOCATION(STRING_STATS_SPLIT_TO_VIEWS, sizeof(string_views_list_t) + sizeof(string_t) * count);
+    list->items = (string_t*)(list + 1);
+    list->size = 0;
+    split_state_t state = init_split_state(str, separator);
+    while (split_next(&state, &list->items[list->size]))
+        list->size++;
+    return list;
+}
+
+wide_string_views_list_t * split_wide_string_to_views(wide_string_t wstr, wchar_t separator)
+{
+    size_t count = 0;
+    if (wstr.length)
+    {
+        count = 1;
+        for (size_t i = 0; i < wstr.length; i++)
+        {
+            if(wstr.data[i] == separator)
+                count++;
+        }
+    }
+    wide_string_views_list_t *list = nnalloc(sizeof(wide_string_views_list_t) + sizeof(wide_string_t) * count);
+    STATS_ALLOCATION(STRING_STATS_SPLIT_TO_VIEWS, sizeof(wide_string_views_list_t) + sizeof(wide_string_t) * count);
+    list->items = (wide_string_t*)(list + 1);
+    list->size = 0;
+    wide_split_state_t state = init_wide_split_state(wstr, separator);
+    while (split_wide_next(&state, &list->items[list->size]))
+        list->size++;
     return list;
 }
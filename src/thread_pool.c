@@ -0,0 +1,286 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    A minimal work-stealing executor for data-parallel loops:
+    every worker owns a range of task indexes, takes tasks from the front
+    of its own range and, once it is empty, steals from the back of the
+    ranges owned by the other workers. The threads are created once per
+    call and pass all phases; a worker that finds no task left waits at
+    a barrier, the last one to arrive runs the serial step, refills
+    the ranges for the next phase and releases the others
+*/
+
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
+#include "thread_pool.h"
+#include "allocator.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+typedef struct
+{
+    _Atomic uint64_t range;
+    char padding[64 - sizeof(uint64_t)];
+} task_range_t;
+
+typedef struct
+{
+    task_range_t *ranges;
+    size_t range_count;
+    const parallel_phase_t *phases;
+    size_t phase_count;
+    size_t task_count;
+    void *context;
+    size_t participant_count;
+    _Atomic size_t arrived;
+    _Atomic size_t generation;
+} executor_t;
+
+typedef struct
+{
+    executor_t *executor;
+    size_t index;
+} worker_t;
+
+static __inline uint64_t pack_range(uint32_t begin, uint32_t end)
+{
+    return ((uint64_t)end << 32) | begin;
+}
+
+static bool take_own_task(task_range_t *range, size_t *index)
+{
+    uint64_t value = atomic_load(&range->range);
+    for (;;)
+    {
+        uint32_t begin = (uint32_t)value,
+            end = (uint32_t)(value >> 32);
+        if (begin >= end)
+            return false;
+        if (atomic_compare_exchange_weak(&range->range, &value, pack_range(begin + 1, end)))
+        {
+            *index = begin;
+            return true;
+        }
+    }
+}
+
+static bool steal_task(task_range_t *range, size_t *index)
+{
+    uint64_t value = atomic_load(&range->range);
+    for (;;)
+    {
+        uint32_t begin = (uint32_t)value,
+            end = (uint32_t)(value >> 32);
+        if (begin >= end)
+            return false;
+        if (atomic_compare_exchange_weak(&range->range, &value, pack_range(begin, end - 1)))
+        {
+            *index = end - 1;
+            return true;
+        }
+    }
+}
+
+static void fill_ranges(executor_t *executor)
+{
+    for (size_t i = 0; i < executor->range_count; i++)
+    {
+        uint32_t begin = (uint32_t)(executor->task_count * i / executor->range_count),
+            end = (uint32_t)(executor->task_count * (i + 1) / executor->range_count);
+        atomic_store_explicit(&executor->ranges[i].range, pack_range(begin, end), memory_order_relaxed);
+    }
+}
+
+static __inline void yield_thread(void)
+{
+#ifdef _WIN32
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+static void wait_for_generation_change(executor_t *executor, size_t generation)
+{
+    while (atomic_load(&executor->generation) == generation)
+        yield_thread();
+}
+
+static void run_phase_tasks(worker_t *worker, parallel_task_t task)
+{
+    executor_t *executor = worker->executor;
+    size_t index;
+    for (;;)
+    {
+        while (take_own_task(&executor->ranges[worker->index], &index))
+            task(executor->context, index);
+        bool stolen = false;
+        for (size_t k = 1; k < executor->range_count && !stolen; k++)
+        {
+            size_t victim = (worker->index + k) % executor->range_count;
+            stolen = steal_task(&executor->ranges[victim], &index);
+        }
+        if (!stolen)
+            return;
+        task(executor->context, index);
+    }
+}
+
+/*
+    The generation cannot change before this worker arrives, so it is
+    read first; the release of the barrier publishes the results
+    of the phase and of its step to all workers
+*/
+static void arrive_at_barrier(executor_t *executor, size_t phase)
+{
+    size_t generation = atomic_load(&executor->generation);
+    if (atomic_fetch_add(&executor->arrived, 1) + 1 < executor->participant_count)
+    {
+        wait_for_generation_change(executor, generation);
+        return;
+    }
+    atomic_store(&executor->arrived, 0);
+    if (executor->phases[phase].step)
+        executor->phases[phase].step(executor->context);
+    if (phase + 1 < executor->phase_count)
+        fill_ranges(executor);
+    atomic_store(&executor->generation, generation + 1);
+}
+
+static void run_worker(worker_t *worker)
+{
+    executor_t *executor = worker->executor;
+    wait_for_generation_change(executor, 0);
+    for (size_t phase = 0; phase < executor->phase_count; phase++)
+    {
+        run_phase_tasks(worker, executor->phases[phase].task);
+        arrive_at_barrier(executor, phase);
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI worker_entry(LPVOID arg)
+{
+    run_worker((worker_t*)arg);
+    return 0;
+}
+
+size_t get_hardware_thread_count(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (size_t)info.dwNumberOfProcessors : 1;
+}
+#else
+static void * worker_entry(void *arg)
+{
+    run_worker((worker_t*)arg);
+    return NULL;
+}
+
+size_t get_hardware_thread_count(void)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (size_t)count : 1;
+}
+#endif
+
+/*
+    The workers wait at the start until all threads are created, so
+    the barrier counts only the threads that have actually started;
+    the ranges of the others are taken by stealing
+*/
+void run_parallel_phases(const parallel_phase_t *phases, size_t phase_count, size_t task_count,
+    size_t thread_count, void *context)
+{
+    if (!thread_count)
+        thread_count = get_hardware_thread_count();
+    if (thread_count > task_count)
+        thread_count = task_count;
+    if (task_count > UINT32_MAX)
+        thread_count = 1;
+    if (thread_count <= 1)
+    {
+        for (size_t phase = 0; phase < phase_count; phase++)
+        {
+            for (size_t i = 0; i < task_count; i++)
+                phases[phase].task(context, i);
+            if (phases[phase].step)
+                phases[phase].step(context);
+        }
+        return;
+    }
+    executor_t executor;
+    executor.ranges = nnalloc(sizeof(task_range_t) * thread_count);
+    executor.range_count = thread_count;
+    executor.phases = phases;
+    executor.phase_count = phase_count;
+    executor.task_count = task_count;
+    executor.context = context;
+    executor.participant_count = 1;
+    atomic_init(&executor.arrived, 0);
+    atomic_init(&executor.generation, 0);
+    fill_ranges(&executor);
+    worker_t *workers = nnalloc(sizeof(worker_t) * thread_count);
+    for (size_t i = 0; i < thread_count; i++)
+    {
+        workers[i].executor = &executor;
+        workers[i].index = i;
+    }
+#ifdef _WIN32
+    HANDLE *threads = nnalloc(sizeof(HANDLE) * thread_count);
+    for (size_t i = 1; i < thread_count; i++)
+    {
+        threads[i] = CreateThread(NULL, 0, worker_entry, &workers[i], 0, NULL);
+        if (threads[i])
+            executor.participant_count++;
+    }
+    atomic_store(&executor.generation, 1);
+    run_worker(&workers[0]);
+    for (size_t i = 1; i < thread_count; i++)
+    {
+        if (threads[i])
+        {
+            WaitForSingleObject(threads[i], INFINITE);
+            CloseHandle(threads[i]);
+        }
+    }
+#else
+    pthread_t *threads = nnalloc(sizeof(pthread_t) * thread_count);
+    bool *started = nnalloc(sizeof(bool) * thread_count);
+    for (size_t i = 1; i < thread_count; i++)
+    {
+        started[i] = 0 == pthread_create(&threads[i], NULL, worker_entry, &workers[i]);
+        if (started[i])
+            executor.participant_count++;
+    }
+    atomic_store(&executor.generation, 1);
+    run_worker(&workers[0]);
+    for (size_t i = 1; i < thread_count; i++)
+    {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+    }
+    free(started);
+#endif
+    free(threads);
+    free(workers);
+    free(executor.ranges);
+}
+
+void run_parallel_tasks(size_t task_count, size_t thread_count, parallel_task_t task, void *context)
+{
+    parallel_phase_t phase = { task, NULL };
+    run_parallel_phases(&phase, 1, task_count, thread_count, context);
+}
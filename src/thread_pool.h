@@ -0,0 +1,25 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    A minimal work-stealing executor for data-parallel loops; a loop may
+    consist of several phases run by the same threads, each phase starts
+    when all tasks of the previous one and its serial step are done
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+typedef void (*parallel_task_t)(void *context, size_t index);
+typedef void (*parallel_step_t)(void *context);
+
+typedef struct
+{
+    parallel_task_t task;
+    parallel_step_t step;
+} parallel_phase_t;
+
+size_t get_hardware_thread_count(void);
+void run_parallel_phases(const parallel_phase_t *phases, size_t phase_count, size_t task_count,
+    size_t thread_count, void *context);
+void run_parallel_tasks(size_t task_count, size_t thread_count, parallel_task_t task, void *context);
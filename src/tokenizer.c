@@ -0,0 +1,308 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    The implementation of the tokenizer: the scanner looks for the next
+    byte of interest (a separator outside quotes, a quote or an escape
+    inside them) with a vectorized classifier, so ordinary field bytes
+    are never examined one by one
+*/
+
+#include "tokenizer.h"
+#include "allocator.h"
+#include "simd.h"
+#include "reallocate.h"
+
+static void init_byte_set(tokenizer_byte_set_t *set, const char *members, size_t count)
+{
+    memset(set, 0, sizeof(tokenizer_byte_set_t));
+    for (size_t i = 0; i < count; i++)
+    {
+        unsigned char ch = (unsigned char)members[i];
+        if (set->table[ch])
+            continue;
+        set->table[ch] = 1;
+        if (set->count < TOKENIZER_MAX_VECTOR_SET)
+        {
+            set->members[set->count] = ch;
+            set->low_nibbles[ch & 0xF] |= (unsigned char)(1 << set->count);
+            set->high_nibbles[ch >> 4] |= (unsigned char)(1 << set->count);
+        }
+        set->count++;
+    }
+}
+
+#ifdef STRINGS_SSE2
+/*
+    Each of up to eight members owns one bit in both nibble tables,
+    so a byte belongs to the set exactly when the bits found by its low
+    and high nibbles intersect
+*/
+static __inline unsigned int classify_block(const tokenizer_byte_set_t *set, const char *data)
+{
+    __m128i v = _mm_loadu_si128((const __m128i*)data);
+#ifdef STRINGS_SSSE3
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    __m128i l = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)set->low_nibbles), _mm_and_si128(v, nibble));
+    __m128i h = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)set->high_nibbles),
+        _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+    return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(l, h), _mm_setzero_si128())) ^ 0xFFFF;
+#else
+    __m128i hits = _mm_setzero_si128();
+    for (unsigned int k = 0; k < set->count; k++)
+        hits = _mm_or_si128(hits, _mm_cmpeq_epi8(v, _mm_set1_epi8((char)set->members[k])));
+    return (unsigned int)_mm_movemask_epi8(hits);
+#endif
+}
+#endif
+
+static size_t find_in_byte_set(const tokenizer_byte_set_t *set, const char *data, size_t length)
+{
+    size_t i = 0;
+#ifdef STRINGS_SSE2
+    if (set->count <= TOKENIZER_MAX_VECTOR_SET)
+    {
+        for (; i + 16 <= length; i += 16)
+        {
+            unsigned int mask = classify_block(set, data + i);
+            if (mask)
+                return i + count_trailing_zeros(mask);
+        }
+    }
+#endif
+    for (; i < length; i++)
+    {
+        if (set->table[(unsigned char)data[i]])
+            return i;
+    }
+    return length;
+}
+
+/*
+    Fields are usually much shorter than a vector, so the separator mask
+    of a whole 64-byte block is kept in the state and consumed bit by bit
+    by the following fields
+*/
+static size_t find_separator(const tokenizer_t *tokenizer, tokenizer_state_t *state, const char *data, size_t length)
+{
+#ifdef STRINGS_SSE2
+    const tokenizer_byte_set_t *set = &tokenizer->separators;
+    if (set->count > TOKENIZER_MAX_VECTOR_SET)
+        return find_in_byte_set(set, data, length);
+    const char *ptr = data;
+    const char *end = data + length;
+    for (;;)
+    {
+        if (state->block && ptr >= state->block && ptr < state->block + 64)
+        {
+            uint64_t mask = state->block_mask >> (ptr - state->block);
+            if (mask)
+                return (size_t)(ptr - data) + count_trailing_zeros_64(mask);
+            ptr = state->block + 64;
+        }
+        if (end - ptr < 64)
+            return (size_t)(ptr - data) + find_in_byte_set(set, ptr, end - ptr);
+        state->block = ptr;
+        state->block_mask = (uint64_t)classify_block(set, ptr)
+            | ((uint64_t)classify_block(set, ptr + 16) << 16)
+            | ((uint64_t)classify_block(set, ptr + 32) << 32)
+            | ((uint64_t)classify_block(set, ptr + 48) << 48);
+    }
+#else
+    (void)state;
+    return find_in_byte_set(&tokenizer->separators, data, length);
+#endif
+}
+
+void init_tokenizer(tokenizer_t *tokenizer, string_t separators, char quote, char escape, bool skip_empty)
+{
+    init_byte_set(&tokenizer->separators, separators.data, separators.length);
+    char quoting[2] = { quote, escape ? escape : quote };
+    init_byte_set(&tokenizer->quoting, quoting, quote ? 2 : 0);
+    tokenizer->quote = quote;
+    tokenizer->escape = escape ? escape : quote;
+    tokenizer->skip_empty = skip_empty;
+}
+
+void destroy_tokenizer_state(tokenizer_state_t *state)
+{
+    free(state->scratch);
+    state->scratch = NULL;
+}
+
+static __inline string_builder_t * append_segment(string_builder_t *obj, const char *begin, const char *end)
+{
+    return end > begin ? append_string(obj, init_string(begin, end - begin)) : obj;
+}
+
+/*
+    Reads a quoted field starting at 'data[0]'; returns the position right
+    after the closing quote; the content is a view of the input unless
+    escapes had to be removed, then it is collected in the scratch builder
+*/
+static size_t read_quoted_field(const tokenizer_t *tokenizer, tokenizer_state_t *state,
+    const char *data, size_t length, string_t *content, bool *copied)
+{
+    size_t start = 1,
+        segment = 1,
+        i = 1;
+    *copied = false;
+    while (i < length)
+    {
+        size_t j = i + find_in_byte_set(&tokenizer->quoting, data + i, length - i);
+        if (j == length)
+            break;
+        bool escaped;
+        if (data[j] == tokenizer->escape && tokenizer->escape != tokenizer->quote)
+            escaped = j + 1 < length;
+        else if (j + 1 < length && data[j + 1] == tokenizer->quote)
+            escaped = true;
+        else
+        {
+            if (*copied)
+                state->scratch = append_segment(state->scratch, data + segment, data + j);
+            *content = *copied ? init_string(state->scratch->data, state->scratch->length)
+                : init_string(data + start, j - start);
+            return j + 1;
+        }
+        if (!escaped)
+        {
+            i = j + 1;
+            continue;
+        }
+        if (!*copied)
+        {
+            *copied = true;
+            if (state->scratch)
+                state->scratch->length = 0;
+        }
+        state->scratch = append_segment(state->scratch, data + segment, data + j);
+        state->scratch = append_char(state->scratch, data[j + 1]);
+        i = j + 2;
+        segment = i;
+    }
+    if (*copied)
+        state->scratch = append_segment(state->scratch, data + segment, data + length);
+    *content = *copied ? init_string(state->scratch->data, state->scratch->length)
+        : init_string(data + start, length - start);
+    return length;
+}
+
+static bool read_field(const tokenizer_t *tokenizer, tokenizer_state_t *state, string_t *token, bool *copied)
+{
+    if (state->finished)
+        return false;
+    const char *data = state->rest.data;
+    size_t length = state->rest.length;
+    size_t end;
+    *copied = false;
+    if (tokenizer->quote && length && data[0] == tokenizer->quote)
+    {
+        size_t i = read_quoted_field(tokenizer, state, data, length, token, copied);
+        end = i + find_separator(tokenizer, state, data + i, length - i);
+        if (end > i)
+        {
+            if (!*copied)
+            {
+                *copied = true;
+                if (state->scratch)
+                    state->scratch->length = 0;
+                state->scratch = append_string(state->scratch, *token);
+            }
+            state->scratch = append_segment(state->scratch, data + i, data + end);
+            *token = init_string(state->scratch->data, state->scratch->length);
+        }
+    }
+    else
+    {
+        end = find_separator(tokenizer, state, data, length);
+        *token = init_string(data, end);
+    }
+    if (end == length)
+    {
+        state->finished = true;
+        state->rest = init_string(data + length, 0);
+    }
+    else
+    {
+        state->rest = init_string(data + end + 1, length - end - 1);
+    }
+    return true;
+}
+
+static bool read_next_field(const tokenizer_t *tokenizer, tokenizer_state_t *state, string_t *token, bool *copied)
+{
+    while (read_field(tokenizer, state, token, copied))
+    {
+        if (token->length || !tokenizer->skip_empty)
+            return true;
+    }
+    return false;
+}
+
+bool tokenize_next(const tokenizer_t *tokenizer, tokenizer_state_t *state, string_t *token)
+{
+    bool copied;
+    return read_next_field(tokenizer, state, token, &copied);
+}
+
+/*
+    Views of fields that needed unescaping are stored with a NULL pointer
+    while the list grows; their text is collected in one builder and
+    moved behind the items of the final single allocation
+*/
+string_views_list_t * tokenize_string_to_views(const tokenizer_t *tokenizer, string_t str)
+{
+    tokenizer_state_t state = init_tokenizer_state(str);
+    string_builder_t *text = NULL;
+    string_t *items = NULL;
+    size_t count = 0,
+        capacity = 0;
+    string_t token;
+    bool copied;
+    while (read_next_field(tokenizer, &state, &token, &copied))
+    {
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 16;
+            items = reallocate_block(items, sizeof(string_t) * count, sizeof(string_t) * capacity);
+        }
+        if (copied)
+        {
+            text = append_string(text, token);
+            token.data = NULL;
+        }
+        items[count++] = token;
+    }
+    size_t text_length = text ? text->length : 0;
+    string_views_list_t *list = nnalloc(sizeof(string_views_list_t) + sizeof(string_t) * count + text_length);
+    list->items = (string_t*)(list + 1);
+    list->size = count;
+    char *dst = (char*)(list->items + count);
+    if (text_length)
+        memcpy(dst, text->data, text_length);
+    for (size_t i = 0; i < count; i++)
+    {
+        list->items[i] = items[i];
+        if (!items[i].data)
+        {
+            list->items[i].data = dst;
+            dst += items[i].length;
+        }
+    }
+    free(items);
+    free(text);
+    destroy_tokenizer_state(&state);
+    return list;
+}
+
+strings_list_t * tokenize_string(const tokenizer_t *tokenizer, string_t str)
+{
+    string_views_list_t *views = tokenize_string_to_views(tokenizer, str);
+    strings_list_t *list = nnalloc(sizeof(strings_list_t));
+    list->size = views->size;
+    list->items = views->size ? nnalloc(sizeof(string_t*) * views->size) : NULL;
+    for (size_t i = 0; i < views->size; i++)
+        list->items[i] = duplicate_string(views->items[i]);
+    free(views);
+    return list;
+}
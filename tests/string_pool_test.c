@@ -0,0 +1,41 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Regression tests of the string pool; the program returns
+    a non-zero exit code if any check fails
+*/
+
+#include "string_pool.h"
+#include <stdio.h>
+
+static int failures = 0;
+
+static void check(bool condition, const char *description)
+{
+    if (!condition)
+    {
+        fprintf(stderr, "FAILED: %s\n", description);
+        failures++;
+    }
+}
+
+static void test_empty_view_with_null_data(void)
+{
+    string_pool_t *pool = create_string_pool(0);
+    const interned_string_t *first = intern_string(pool, init_string(NULL, 0));
+    const interned_string_t *second = intern_string(pool, init_string(NULL, 0));
+    check(first != NULL, "an empty view is interned");
+    check(first == second, "an empty view is interned once");
+    check(first->str.length == 0 && first->str.data[0] == '\0', "the interned empty string is terminated");
+    check(find_interned_string(pool, init_string(NULL, 0)) == first, "an empty view is found");
+    check(intern_string(pool, init_string("", 0)) == first, "empty views are equal regardless of data");
+    destroy_string_pool(pool);
+}
+
+int main(void)
+{
+    test_empty_view_with_null_data();
+    if (!failures)
+        printf("string_pool: all tests passed\n");
+    return failures ? 1 : 0;
+}
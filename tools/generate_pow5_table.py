@@ -0,0 +1,55 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+#
+# Generates src/pow5_table.h: 128-bit approximations of the powers of five
+# from 5^-342 to 5^308 used by the Eisel-Lemire algorithm when parsing
+# doubles. Each power is normalized so that its most significant bit is set;
+# positive powers are truncated, negative ones are rounded up.
+#
+# Usage: python3 tools/generate_pow5_table.py > src/pow5_table.h
+
+import sys
+
+SMALLEST_POWER = -342
+LARGEST_POWER = 308
+
+
+def approximate_power_of_five(q):
+    if q >= 0:
+        value = 5 ** q
+        while value < (1 << 127):
+            value *= 2
+        while value >= (1 << 128):
+            value //= 2
+        return value
+    power = 5 ** -q
+    z = power.bit_length()
+    if q >= -27:
+        return 2 ** (z + 127) // power + 1
+    value = 2 ** (2 * z + 128) // power + 1
+    while value >= (1 << 128):
+        value //= 2
+    return value
+
+
+def main():
+    out = sys.stdout
+    out.write('/*\n'
+              '    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>\n\n'
+              '    Normalized 128-bit powers of five for the Eisel-Lemire algorithm;\n'
+              '    generated by tools/generate_pow5_table.py, do not edit\n'
+              '*/\n\n')
+    out.write('#pragma once\n\n#include <stdint.h>\n\n')
+    out.write('#define SMALLEST_POWER_OF_FIVE %d\n' % SMALLEST_POWER)
+    out.write('#define LARGEST_POWER_OF_FIVE %d\n\n' % LARGEST_POWER)
+    out.write('static const uint64_t powers_of_five_128[] =\n{\n')
+    for q in range(SMALLEST_POWER, LARGEST_POWER + 1):
+        value = approximate_power_of_five(q)
+        assert (1 << 127) <= value < (1 << 128)
+        out.write('    0x%016xULL, 0x%016xULL,\n' % (value >> 64, value & ((1 << 64) - 1)))
+    out.write('};\n')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+#
+# Generates src/unicode_tables.h: the simple (one-to-one) case mappings
+# and the White_Space property as a two-stage lookup table built from
+# the Unicode Character Database bundled with Python.
+#
+# Usage: python3 tools/generate_unicode_tables.py > src/unicode_tables.h
+
+import sys
+import unicodedata
+
+WHITE_SPACE = [0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x20, 0x85, 0xA0, 0x1680] + list(range(0x2000, 0x200B)) \
+    + [0x2028, 0x2029, 0x202F, 0x205F, 0x3000]
+
+
+def simple_mapping(cp, convert):
+    # Mappings that expand to several code points (e.g. U+00DF to "SS") are not simple ones
+    result = convert(chr(cp))
+    return ord(result) - cp if len(result) == 1 else 0
+
+
+def simple_fold(cp):
+    delta = simple_mapping(cp, str.casefold)
+    if delta == 0 and len(chr(cp).casefold()) != 1:
+        delta = simple_mapping(cp, str.lower)
+    return delta
+
+
+def build_records():
+    records = {(0, 0, 0, 0): 0}
+    values = []
+    limit = 0
+    for cp in range(0x110000):
+        if 0xD800 <= cp <= 0xDFFF:
+            record = (0, 0, 0, 0)
+        else:
+            record = (simple_mapping(cp, str.lower), simple_mapping(cp, str.upper), simple_fold(cp),
+                      1 if cp in WHITE_SPACE else 0)
+        for delta in record[:3]:
+            # A mapping must stay on the same side of U+FFFF to be usable with 16-bit wchar_t
+            assert (cp < 0x10000) == (cp + delta < 0x10000)
+        if record != (0, 0, 0, 0):
+            limit = cp + 1
+        values.append(records.setdefault(record, len(records)))
+    return sorted(records, key=records.get), values, limit
+
+
+def split_blocks(values, shift):
+    size = 1 << shift
+    blocks = {}
+    stage1 = []
+    stage2 = []
+    for start in range(0, len(values), size):
+        block = tuple(values[start:start + size])
+        if block not in blocks:
+            blocks[block] = len(blocks)
+            stage2.extend(block)
+        stage1.append(blocks[block])
+    return stage1, stage2
+
+
+def c_type(values):
+    return 'uint8_t' if max(values) < 0x100 else 'uint16_t'
+
+
+def print_array(out, declaration, values, per_line):
+    out.write(declaration + ' =\n{\n')
+    for start in range(0, len(values), per_line):
+        out.write('    ' + ', '.join(str(v) for v in values[start:start + per_line]) + ',\n')
+    out.write('};\n\n')
+
+
+def main():
+    records, values, limit = build_records()
+    size = lambda s: len(s[0]) * (1 if max(s[0]) < 0x100 else 2) + len(s[1]) * (1 if max(s[1]) < 0x100 else 2)
+    best_shift = min(range(4, 11), key=lambda shift: size(split_blocks(values[:limit], shift)))
+    limit = (limit + (1 << best_shift) - 1) >> best_shift << best_shift
+    stage1, stage2 = split_blocks(values[:limit], best_shift)
+    out = sys.stdout
+    out.write('/*\n'
+              '    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>\n\n'
+              '    Simple case mappings and the White_Space property, Unicode %s;\n'
+              '    generated by tools/generate_unicode_tables.py, do not edit\n'
+              '*/\n\n' % unicodedata.unidata_version)
+    out.write('#pragma once\n\n#include <stdint.h>\n\n')
+    out.write('#define UNICODE_TABLES_LIMIT 0x%X\n' % limit)
+    out.write('#define UNICODE_BLOCK_SHIFT %d\n\n' % best_shift)
+    out.write('typedef struct\n{\n    int32_t lower;\n    int32_t upper;\n    int32_t fold;\n'
+              '    int32_t white_space;\n} unicode_properties_t;\n\n')
+    out.write('static const unicode_properties_t unicode_properties[] =\n{\n')
+    for record in records:
+        out.write('    { %d, %d, %d, %d },\n' % record)
+    out.write('};\n\n')
+    print_array(out, 'static const %s unicode_blocks[]' % c_type(stage1), stage1, 24)
+    print_array(out, 'static const %s unicode_block_items[]' % c_type(stage2), stage2, 24)
+
+
+if __name__ == '__main__':
+    main()